@@ -0,0 +1,726 @@
+#include <sched.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <libataxx/move.hpp>
+#include <libataxx/position.hpp>
+#include <random>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "../src/search/tryhard/nnue_model.hpp"
+#include "../src/search/tryhard/nnue_quantized.hpp"
+#include "../src/search/tryhard/nnue_simd.hpp"
+#include "../src/search/tryhard/refresh_cache.hpp"
+#include "../src/search/tryhard/tryhard.hpp"
+#include "../tests/nnue-random.hpp"
+
+// Microbenchmarks for the NNUE evaluation.
+// usage: bench_nnue [--cpu n] [path to float weights]. Without a path a fixed random network is used.
+// --cpu pins the benchmark to core n, keeping the scheduler from moving it between caches mid trial.
+
+namespace {
+
+constexpr std::size_t num_samples = 4096;
+constexpr int min_flips = 3;
+constexpr int repeats = 64;
+constexpr int trials = 5;
+// Plies of a line searched from one root, see random_lines
+constexpr int line_plies = 64;
+
+int flips(const libataxx::Position &pos, const libataxx::Move &move) {
+    return (libataxx::Bitboard{move.to()}.singles() & pos.them()).count();
+}
+
+// Middlegame positions paired with a move that captures at least min_flips stones.
+// Games are played out at random with a preference for captures so the board fills up quickly.
+std::vector<std::pair<libataxx::Position, libataxx::Move>> capture_samples() {
+    std::vector<std::pair<libataxx::Position, libataxx::Move>> samples;
+    std::mt19937 gen{42};
+
+    while (samples.size() < num_samples) {
+        libataxx::Position pos{"startpos"};
+
+        while (!pos.gameover() && samples.size() < num_samples) {
+            libataxx::Move moves[libataxx::max_moves];
+            const int num_moves = pos.legal_moves(moves);
+
+            int best = 0;
+            for (int i = 0; i < num_moves; ++i) {
+                if (flips(pos, moves[i]) >= min_flips) {
+                    samples.emplace_back(pos, moves[i]);
+                }
+                best = flips(pos, moves[i]) > flips(pos, moves[best]) ? i : best;
+            }
+
+            const bool greedy = std::uniform_int_distribution<int>{0, 1}(gen);
+            const int choice = greedy ? best : std::uniform_int_distribution<int>{0, num_moves - 1}(gen);
+            pos.makemove(moves[choice]);
+        }
+    }
+
+    samples.resize(num_samples);
+    return samples;
+}
+
+// The same change with every flip row written out as the erase and insert it stands for
+nnue::feature_delta expand_flips(const nnue::feature_delta &delta) {
+    constexpr std::size_t squares = nnue::half_ka_numel / 2;
+    nnue::feature_delta result;
+    for (std::size_t i = 0; i < delta.num_added; ++i) {
+        const std::size_t idx = delta.added[i];
+        if (idx >= nnue::half_ka_numel) {
+            result.add(idx - nnue::half_ka_numel);
+            result.remove(idx - squares);
+        } else {
+            result.add(idx);
+        }
+    }
+    for (std::size_t i = 0; i < delta.num_removed; ++i) {
+        const std::size_t idx = delta.removed[i];
+        if (idx >= nnue::half_ka_numel) {
+            result.remove(idx - nnue::half_ka_numel);
+            result.add(idx - squares);
+        } else {
+            result.remove(idx);
+        }
+    }
+    return result;
+}
+
+struct update_sample {
+    std::size_t parent;
+    nnue::feature_delta white;
+    nnue::feature_delta black;
+};
+
+// The accumulator update before the fused kernel: one pass over the accumulator per feature
+template <typename Eval>
+void per_feature_update(Eval &child, const Eval &parent, const update_sample &sample) {
+    child.white.active_ = parent.white.active_;
+    child.black.active_ = parent.black.active_;
+    for (std::size_t i = 0; i < sample.white.num_added; ++i) {
+        child.white.insert(sample.white.added[i]);
+    }
+    for (std::size_t i = 0; i < sample.white.num_removed; ++i) {
+        child.white.erase(sample.white.removed[i]);
+    }
+    for (std::size_t i = 0; i < sample.black.num_added; ++i) {
+        child.black.insert(sample.black.added[i]);
+    }
+    for (std::size_t i = 0; i < sample.black.num_removed; ++i) {
+        child.black.erase(sample.black.removed[i]);
+    }
+}
+
+template <typename Eval>
+void fused_update(Eval &child, const Eval &parent, const update_sample &sample) {
+    child.white.update(parent.white, sample.white);
+    child.black.update(parent.black, sample.black);
+}
+
+// Time in nanoseconds of one child update, both perspectives, averaged over a trial. Best of several trials.
+template <typename Eval, typename F>
+double time_update(const std::vector<update_sample> &samples, const std::vector<Eval> &parents, Eval &child, F &&f) {
+    double best = std::numeric_limits<double>::max();
+    for (int t = 0; t < trials; ++t) {
+        const auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; ++r) {
+            for (const auto &sample : samples) {
+                f(child, parents[sample.parent], sample);
+                asm volatile("" : : "r"(&child) : "memory");
+            }
+        }
+        const auto finish = std::chrono::steady_clock::now();
+        const std::chrono::duration<double, std::nano> elapsed = finish - start;
+        best = std::min(best, elapsed.count() / (static_cast<double>(repeats) * samples.size()));
+    }
+    return best;
+}
+
+template <typename T>
+bool close(const T a, const T b) {
+    if constexpr (std::is_integral_v<T>) {
+        return a == b;
+    } else {
+        return std::abs(a - b) <= T{1e-4} * std::max(T{1}, std::abs(b));
+    }
+}
+
+template <typename Eval>
+void bench_update(const std::string &label,
+                  const typename Eval::weights_type &weights,
+                  const std::vector<std::pair<libataxx::Position, libataxx::Move>> &positions) {
+    using Tryhard = search::tryhard::Tryhard<Eval>;
+
+    // Deltas are collected up front so only applying them is timed
+    std::vector<Eval> parents(positions.size(), Eval{&weights});
+    std::vector<update_sample> flipped(positions.size());
+    std::vector<update_sample> expanded(positions.size());
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        nnue::feature_delta white;
+        nnue::feature_delta black;
+        Tryhard::position_delta(positions[i].first, white, black);
+        parents[i].white.refresh(white);
+        parents[i].black.refresh(black);
+
+        flipped[i].parent = expanded[i].parent = i;
+        Tryhard::move_delta(positions[i].first, positions[i].second, flipped[i].white, flipped[i].black);
+        expanded[i].white = expand_flips(flipped[i].white);
+        expanded[i].black = expand_flips(flipped[i].black);
+    }
+
+    // The paths have to agree before their timings mean anything. Flip rows round differently in float.
+    auto expected = Eval{&weights};
+    auto child = Eval{&weights};
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        per_feature_update(expected, parents[i], expanded[i]);
+        fused_update(child, parents[i], flipped[i]);
+        for (std::size_t j = 0; j < nnue::base_dim; ++j) {
+            if (!close(expected.white.active_.data[j], child.white.active_.data[j]) ||
+                !close(expected.black.active_.data[j], child.black.active_.data[j])) {
+                std::cerr << label << ": fused update disagrees with the per feature update" << std::endl;
+                std::exit(1);
+            }
+        }
+    }
+
+    const double per_feature = time_update(expanded, parents, child, per_feature_update<Eval>);
+    const double fused = time_update(expanded, parents, child, fused_update<Eval>);
+    const double flip_rows = time_update(flipped, parents, child, fused_update<Eval>);
+
+    std::cout << std::left << std::setw(14) << label << std::right << std::fixed << std::setprecision(1)
+              << " per-feature " << std::setw(6) << per_feature << " ns"
+              << "   fused " << std::setw(6) << fused << " ns"
+              << "   fused+flip rows " << std::setw(6) << flip_rows << " ns" << std::endl;
+}
+
+// Positions of consecutive plies, as an analysis GUI stepping through games would send them
+std::vector<libataxx::Position> game_positions() {
+    std::vector<libataxx::Position> positions;
+    std::mt19937 gen{7};
+    while (positions.size() < num_samples) {
+        libataxx::Position pos{"startpos"};
+        while (!pos.gameover() && positions.size() < num_samples) {
+            positions.push_back(pos);
+            libataxx::Move moves[libataxx::max_moves];
+            const int num_moves = pos.legal_moves(moves);
+            pos.makemove(moves[std::uniform_int_distribution<int>{0, num_moves - 1}(gen)]);
+        }
+    }
+    return positions;
+}
+
+// Time in nanoseconds of refreshing both accumulators of a position, best of several trials
+template <typename Eval, typename F>
+double time_refresh(const std::vector<libataxx::Position> &positions, Eval &evaluator, F &&f) {
+    double best = std::numeric_limits<double>::max();
+    for (int t = 0; t < trials; ++t) {
+        const auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; ++r) {
+            for (const auto &pos : positions) {
+                f(evaluator, pos);
+                asm volatile("" : : "r"(&evaluator) : "memory");
+            }
+        }
+        const auto finish = std::chrono::steady_clock::now();
+        const std::chrono::duration<double, std::nano> elapsed = finish - start;
+        best = std::min(best, elapsed.count() / (static_cast<double>(repeats) * positions.size()));
+    }
+    return best;
+}
+
+template <typename Eval>
+void bench_refresh(const std::string &label,
+                   const typename Eval::weights_type &weights,
+                   const std::vector<libataxx::Position> &positions) {
+    using Tryhard = search::tryhard::Tryhard<Eval>;
+
+    auto evaluator = Eval{&weights};
+    const double bias = time_refresh(positions, evaluator, [](Eval &e, const libataxx::Position &pos) {
+        nnue::feature_delta white;
+        nnue::feature_delta black;
+        Tryhard::position_delta(pos, white, black);
+        e.white.refresh(white);
+        e.black.refresh(black);
+    });
+    search::tryhard::RefreshCache<Eval> cache;
+    const double cached = time_refresh(
+        positions, evaluator, [&cache](Eval &e, const libataxx::Position &pos) { cache.refresh(e, pos); });
+
+    std::cout << std::left << std::setw(14) << label << std::right << std::fixed << std::setprecision(1)
+              << " from bias " << std::setw(6) << bias << " ns"
+              << "   cached " << std::setw(6) << cached << " ns"
+              << "   (" << cache.hits() << " hits, " << cache.misses() << " misses)" << std::endl;
+}
+
+// Time in nanoseconds per position of the dense layers, one position at a time and as batches
+template <typename Eval>
+void bench_evaluate(const std::string &label,
+                    const typename Eval::weights_type &weights,
+                    const std::vector<libataxx::Position> &positions) {
+    using Tryhard = search::tryhard::Tryhard<Eval>;
+
+    std::vector<Eval> evaluators(positions.size(), Eval{&weights});
+    std::unique_ptr<bool[]> povs(new bool[positions.size()]);
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        nnue::feature_delta white;
+        nnue::feature_delta black;
+        Tryhard::position_delta(positions[i], white, black);
+        evaluators[i].white.refresh(white);
+        evaluators[i].black.refresh(black);
+        povs[i] = static_cast<bool>(positions[i].turn());
+    }
+    std::vector<int> scores(positions.size());
+    std::vector<int> batch_scores(positions.size());
+
+    const auto time = [&](auto &&f) {
+        double best = std::numeric_limits<double>::max();
+        for (int t = 0; t < trials; ++t) {
+            const auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repeats / 8; ++r) {
+                f();
+                asm volatile("" : : "r"(scores.data()), "r"(batch_scores.data()) : "memory");
+            }
+            const auto finish = std::chrono::steady_clock::now();
+            const std::chrono::duration<double, std::nano> elapsed = finish - start;
+            best = std::min(best, elapsed.count() / (static_cast<double>(repeats / 8) * positions.size()));
+        }
+        return best;
+    };
+
+    const double single = time([&]() {
+        for (std::size_t i = 0; i < positions.size(); ++i) {
+            scores[i] = evaluators[i].evaluate(povs[i]);
+        }
+    });
+    const double batched = time([&]() {
+        Eval::evaluate_batch(evaluators.data(), povs.get(), batch_scores.data(), positions.size());
+    });
+
+    if (scores != batch_scores) {
+        std::cerr << label << ": batched evaluation disagrees with evaluate()" << std::endl;
+        std::exit(1);
+    }
+
+    std::cout << std::left << std::setw(14) << label << std::right << std::fixed << std::setprecision(1)
+              << " single " << std::setw(6) << single << " ns"
+              << "   batch " << std::setw(6) << batched << " ns" << std::endl;
+}
+
+// Every position one ply after a game position: what a search evaluates at its leaves
+std::vector<libataxx::Position> leaf_positions(const std::vector<libataxx::Position> &games) {
+    std::vector<libataxx::Position> leaves;
+    for (const auto &pos : games) {
+        libataxx::Move moves[libataxx::max_moves];
+        const int num_moves = pos.legal_moves(moves);
+        for (int i = 0; i < num_moves && leaves.size() < num_samples; i += 7) {
+            auto child = pos;
+            child.makemove(moves[i]);
+            leaves.push_back(child);
+        }
+    }
+    return leaves;
+}
+
+// Time in nanoseconds of fc0 on the input of evaluate(), dense and reading only the positive inputs
+template <typename Eval, typename Layer>
+void bench_fc0(const std::string &label,
+               const typename Eval::weights_type &weights,
+               const Layer &fc0,
+               const std::vector<libataxx::Position> &positions) {
+    using Tryhard = search::tryhard::Tryhard<Eval>;
+    using input_type = std::remove_reference_t<decltype(Eval{&weights}.white.active_.data[0])>;
+    constexpr std::size_t dim = 2 * nnue::base_dim;
+
+    std::vector<nnue::stack_vector<input_type, dim>> inputs;
+    double positive = 0.0;
+    for (const auto &pos : positions) {
+        auto evaluator = Eval{&weights};
+        nnue::feature_delta white;
+        nnue::feature_delta black;
+        Tryhard::position_delta(pos, white, black);
+        evaluator.white.refresh(white);
+        evaluator.black.refresh(black);
+        const bool pov = static_cast<bool>(pos.turn());
+        const auto &us = pov ? evaluator.white : evaluator.black;
+        const auto &them = pov ? evaluator.black : evaluator.white;
+        inputs.push_back(splice(us.active(), them.active()));
+        for (std::size_t i = 0; i < dim; ++i) {
+            positive += inputs.back().data[i] > input_type{0};
+        }
+    }
+
+    const auto time = [&](auto &&f) {
+        double best = std::numeric_limits<double>::max();
+        for (int t = 0; t < trials; ++t) {
+            const auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repeats; ++r) {
+                for (const auto &x : inputs) {
+                    auto out = f(x);
+                    asm volatile("" : : "r"(&out) : "memory");
+                }
+            }
+            const auto finish = std::chrono::steady_clock::now();
+            const std::chrono::duration<double, std::nano> elapsed = finish - start;
+            best = std::min(best, elapsed.count() / (static_cast<double>(repeats) * inputs.size()));
+        }
+        return best;
+    };
+
+    for (const auto &x : inputs) {
+        const auto dense = fc0.forward(x.apply(nnue::relu<input_type>));
+        const auto sparse = fc0.relu_forward(x);
+        if (!std::equal(dense.data, dense.data + 32, sparse.data)) {
+            std::cerr << label << ": sparse fc0 disagrees with the dense layer" << std::endl;
+            std::exit(1);
+        }
+    }
+
+    const double dense = time([&fc0](const auto &x) { return fc0.forward(x.apply(nnue::relu<input_type>)); });
+    const double sparse = time([&fc0](const auto &x) { return fc0.relu_forward(x); });
+
+    std::cout << std::left << std::setw(14) << label << std::right << std::fixed << std::setprecision(1)
+              << " dense " << std::setw(6) << dense << " ns"
+              << "   sparse " << std::setw(6) << sparse << " ns"
+              << "   (" << std::setprecision(0) << 100.0 * positive / (dim * inputs.size()) << "% inputs positive)"
+              << std::endl;
+}
+
+// Time in nanoseconds of a fused update with flip rows, both perspectives
+template <typename Eval>
+double time_fused(const typename Eval::weights_type &weights,
+                  const std::vector<std::pair<libataxx::Position, libataxx::Move>> &positions) {
+    using Tryhard = search::tryhard::Tryhard<Eval>;
+
+    std::vector<Eval> parents(positions.size(), Eval{&weights});
+    std::vector<update_sample> samples(positions.size());
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        nnue::feature_delta white;
+        nnue::feature_delta black;
+        Tryhard::position_delta(positions[i].first, white, black);
+        parents[i].white.refresh(white);
+        parents[i].black.refresh(black);
+        samples[i].parent = i;
+        Tryhard::move_delta(positions[i].first, positions[i].second, samples[i].white, samples[i].black);
+    }
+
+    auto child = Eval{&weights};
+    return time_update(samples, parents, child, fused_update<Eval>);
+}
+
+// Update time of feature transformer rows narrowed to Row, and how far their scores drift from float
+template <typename Arch, typename Row>
+void bench_narrowed(const std::string &label,
+                    const nnue::weights<float, Arch> &weights,
+                    const std::vector<std::pair<libataxx::Position, libataxx::Move>> &samples,
+                    const std::vector<libataxx::Position> &positions) {
+    using FloatTryhard = search::tryhard::Tryhard<nnue::eval<float, Arch>>;
+    using Tryhard = search::tryhard::Tryhard<nnue::eval<float, Arch, Row>>;
+
+    const auto narrowed = nnue::weights<float, Arch, Row>{}.narrow(weights);
+    double total = 0.0;
+    int worst = 0;
+    for (const auto &pos : positions) {
+        const int drift = std::abs(Tryhard::eval(pos, narrowed) - FloatTryhard::eval(pos, weights));
+        total += drift;
+        worst = std::max(worst, drift);
+    }
+
+    const double update = time_fused<nnue::eval<float, Arch, Row>>(narrowed, samples);
+    std::cout << std::left << std::setw(14) << label << std::right << std::fixed << std::setprecision(1)
+              << " update " << std::setw(6) << update << " ns"
+              << "   drift " << std::setprecision(2) << total / positions.size() << " cp mean, " << worst << " cp max"
+              << std::endl;
+}
+
+// Update and dense layer costs of a random network of every compiled in architecture
+template <typename Arch>
+void bench_architecture(const std::vector<std::pair<libataxx::Position, libataxx::Move>> &samples,
+                        const std::vector<libataxx::Position> &positions) {
+    const auto weights = random_weights<Arch>();
+    const auto quantized_weights = nnue::basic_quantized_weights<Arch>{}.quantize(weights);
+    const auto width = std::to_string(Arch::base_dim);
+
+    bench_update<nnue::eval<float, Arch>>("float " + width, weights, samples);
+    bench_update<nnue::basic_quantized_eval<Arch>>("quantized " + width, quantized_weights, samples);
+    bench_evaluate<nnue::eval<float, Arch>>("float " + width, weights, positions);
+    bench_evaluate<nnue::basic_quantized_eval<Arch>>("quantized " + width, quantized_weights, positions);
+}
+
+// Float rows against bf16 and fp16 rows of a random network of every compiled in architecture
+template <typename Arch>
+void bench_half(const std::vector<std::pair<libataxx::Position, libataxx::Move>> &samples,
+                const std::vector<libataxx::Position> &positions) {
+    const auto weights = random_weights<Arch>();
+    const auto width = std::to_string(Arch::base_dim);
+
+    const double update = time_fused<nnue::eval<float, Arch>>(weights, samples);
+    std::cout << std::left << std::setw(14) << "float " + width << std::right << std::fixed << std::setprecision(1)
+              << " update " << std::setw(6) << update << " ns" << std::endl;
+    bench_narrowed<Arch, nnue::bf16>("bf16 " + width, weights, samples, positions);
+    bench_narrowed<Arch, nnue::fp16>("fp16 " + width, weights, samples, positions);
+}
+
+// Time in nanoseconds per op of f, one pass over ops ops, best of several trials
+template <typename F>
+double time_ops(const std::size_t ops, F &&f) {
+    double best = std::numeric_limits<double>::max();
+    for (int t = 0; t < trials; ++t) {
+        const auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; ++r) {
+            f();
+        }
+        const auto finish = std::chrono::steady_clock::now();
+        const std::chrono::duration<double, std::nano> elapsed = finish - start;
+        best = std::min(best, elapsed.count() / (static_cast<double>(repeats) * ops));
+    }
+    return best;
+}
+
+// Bytes per nanosecond are GB/s
+void report(const std::string &label, const std::string &op, const double ns, const double bytes) {
+    std::cout << std::left << std::setw(14) << label << std::setw(14) << op << std::right << std::fixed
+              << std::setprecision(1) << std::setw(8) << ns << " ns/op" << std::setw(8) << bytes / ns << " GB/s"
+              << std::endl;
+}
+
+// Parameter bytes of a dense layer
+template <typename Layer>
+constexpr double layer_bytes(const Layer &layer) {
+    return sizeof(layer.W[0]) * Layer::W_numel + sizeof(layer.b[0]) * Layer::b_numel;
+}
+
+// Moves of a line of play from a root, as a search descends the tree
+struct line {
+    libataxx::Position root;
+    std::vector<libataxx::Move> moves;
+};
+
+// Lines of line_plies random legal moves, so quiet moves, jumps and captures come in the proportion a search sees
+std::vector<line> random_lines() {
+    std::vector<line> lines;
+    std::size_t plies = 0;
+    std::mt19937 gen{17};
+    while (plies < num_samples) {
+        libataxx::Position pos{"startpos"};
+        while (!pos.gameover() && plies < num_samples) {
+            line l{pos, {}};
+            while (!pos.gameover() && l.moves.size() < line_plies) {
+                libataxx::Move moves[libataxx::max_moves];
+                const int num_moves = pos.legal_moves(moves);
+                l.moves.push_back(moves[std::uniform_int_distribution<int>{0, num_moves - 1}(gen)]);
+                pos.makemove(l.moves.back());
+            }
+            plies += l.moves.size();
+            lines.push_back(std::move(l));
+        }
+    }
+    return lines;
+}
+
+// Cost per op of each step of the evaluator on its own, and the bytes it moves. Accumulator updates count the
+// rows they read and the accumulators they read and write, dense layers count their parameters.
+template <typename Eval>
+void bench_ops(const std::string &label,
+               const typename Eval::weights_type &weights,
+               const std::vector<libataxx::Position> &positions,
+               const std::vector<line> &lines) {
+    using Tryhard = search::tryhard::Tryhard<Eval>;
+    using acc_type = std::remove_reference_t<decltype(Eval{&weights}.white.active_.data[0])>;
+    using row_type = std::remove_pointer_t<decltype(weights.w.row(0))>;
+    constexpr std::size_t dim = decltype(Eval{&weights}.white)::dim;
+    constexpr double row_bytes = sizeof(row_type) * dim;
+    constexpr double acc_bytes = sizeof(acc_type) * dim;
+
+    // A row in and out of one accumulator, so its values stay put
+    std::vector<std::size_t> features(num_samples);
+    std::mt19937 gen{19};
+    for (auto &idx : features) {
+        idx = std::uniform_int_distribution<std::size_t>{0, nnue::half_ka_numel - 1}(gen);
+    }
+    auto evaluator = Eval{&weights};
+    const double insert_erase = time_ops(2 * features.size(), [&]() {
+        for (const auto idx : features) {
+            evaluator.white.insert(idx);
+            evaluator.white.erase(idx);
+            asm volatile("" : : "r"(&evaluator) : "memory");
+        }
+    });
+    report(label, "insert/erase", insert_erase, row_bytes + 2 * acc_bytes);
+
+    // update() then eval() at every ply of a line, as the search calls them, with the eval cache off
+    auto tryhard = std::make_unique<Tryhard>(1, 0, 0, weights);
+    typename Tryhard::Stack stack[search::tryhard::max_depth + 1];
+    double line_bytes = 0.0;
+    std::size_t plies = 0;
+    for (const auto &l : lines) {
+        auto pos = l.root;
+        for (const auto &move : l.moves) {
+            nnue::feature_delta white;
+            nnue::feature_delta black;
+            Tryhard::move_delta(pos, move, white, black);
+            line_bytes += row_bytes * (white.num_added + white.num_removed + black.num_added + black.num_removed) +
+                          4 * acc_bytes;
+            pos.makemove(move);
+        }
+        plies += l.moves.size();
+    }
+    for (int i = 0; i <= search::tryhard::max_depth; ++i) {
+        stack[i].ply = i;
+    }
+    // The roots are set up outside of the clock, their refreshes are timed by init_pos below
+    const auto time_lines = [&](const bool evaluate) {
+        double best = std::numeric_limits<double>::max();
+        for (int t = 0; t < trials; ++t) {
+            double elapsed = 0.0;
+            int sum = 0;
+            for (int r = 0; r < repeats / 8; ++r) {
+                for (const auto &l : lines) {
+                    tryhard->init_pos(l.root);
+                    auto pos = l.root;
+                    const auto start = std::chrono::steady_clock::now();
+                    for (std::size_t ply = 0; ply < l.moves.size(); ++ply) {
+                        tryhard->update(&stack[ply], pos, l.moves[ply]);
+                        pos.makemove(l.moves[ply]);
+                        if (evaluate) {
+                            sum += tryhard->eval(&stack[ply + 1], pos);
+                        }
+                    }
+                    const auto finish = std::chrono::steady_clock::now();
+                    elapsed += std::chrono::duration<double, std::nano>(finish - start).count();
+                }
+            }
+            asm volatile("" : : "r"(sum) : "memory");
+            best = std::min(best, elapsed / (static_cast<double>(repeats / 8) * plies));
+        }
+        return best;
+    };
+    // Playing the moves is not the evaluator's cost, and is timed on its own to be taken out
+    const double moves_only = time_lines(false);
+    const double update_eval = time_lines(true) - moves_only;
+    const double dense_bytes = layer_bytes(weights.fc0) + layer_bytes(weights.fc1) + layer_bytes(weights.fc2);
+    report(label, "update+eval", update_eval, line_bytes / plies + dense_bytes);
+
+    // Both accumulators from the refresh cache, which consecutive game positions mostly hit. Its bytes are those
+    // of a refresh from the bias, so the GB/s are what a refresh would need to match it.
+    double refresh_bytes = 0.0;
+    for (const auto &pos : positions) {
+        refresh_bytes += 2 * row_bytes * (pos.white() | pos.black()).count() + 2 * acc_bytes;
+    }
+    const double init_pos = time_ops(positions.size(), [&]() {
+        for (const auto &pos : positions) {
+            tryhard->init_pos(pos);
+            asm volatile("" : : "r"(tryhard.get()) : "memory");
+        }
+    });
+    report(label, "init_pos", init_pos, refresh_bytes / positions.size());
+
+    // Refresh from the bias and the dense layers, as evalfile and the eval command do
+    const double static_eval = time_ops(positions.size(), [&]() {
+        int sum = 0;
+        for (const auto &pos : positions) {
+            sum += Tryhard::eval(pos, weights);
+        }
+        asm volatile("" : : "r"(sum) : "memory");
+    });
+    report(label, "static eval", static_eval, refresh_bytes / positions.size() + dense_bytes);
+
+    std::vector<Eval> evaluators(positions.size(), Eval{&weights});
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        nnue::feature_delta white;
+        nnue::feature_delta black;
+        Tryhard::position_delta(positions[i], white, black);
+        evaluators[i].white.refresh(white);
+        evaluators[i].black.refresh(black);
+    }
+    const double propagate = time_ops(positions.size(), [&]() {
+        float sum = 0.0f;
+        for (std::size_t i = 0; i < positions.size(); ++i) {
+            sum += evaluators[i].propagate(static_cast<bool>(positions[i].turn()));
+        }
+        asm volatile("" : : "r"(sum) : "memory");
+    });
+    report(label, "propagate", propagate, dense_bytes);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    int arg = 1;
+    if (arg + 1 < argc && std::strcmp(argv[arg], "--cpu") == 0) {
+        const int cpu = std::atoi(argv[arg + 1]);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            std::cerr << "can't pin to cpu " << cpu << std::endl;
+            return 1;
+        }
+        std::cout << "pinned to cpu " << cpu << std::endl;
+        arg += 2;
+    }
+
+    nnue::weights<float> weights;
+    if (arg < argc) {
+        try {
+            weights.load(argv[arg]);
+        } catch (const nnue::load_error &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    } else {
+        weights = random_weights();
+    }
+    const auto quantized_weights = nnue::quantized_weights{}.quantize(weights);
+
+    const auto samples = capture_samples();
+    double total_flips = 0.0;
+    for (const auto &[pos, move] : samples) {
+        total_flips += flips(pos, move);
+    }
+
+    std::cout << "simd " << nnue::simd::name(nnue::simd::active.isa) << std::endl;
+    std::cout << "update: " << samples.size() << " captures of at least " << min_flips << " stones, "
+              << std::fixed << std::setprecision(2) << total_flips / samples.size() << " on average" << std::endl;
+    bench_update<nnue::eval<float>>("float", weights, samples);
+    bench_update<nnue::quantized_eval>("quantized", quantized_weights, samples);
+
+    const auto positions = game_positions();
+    std::cout << "refresh: " << positions.size() << " consecutive game positions" << std::endl;
+    bench_refresh<nnue::eval<float>>("float", weights, positions);
+    bench_refresh<nnue::quantized_eval>("quantized", quantized_weights, positions);
+
+    std::cout << "evaluate: dense layers of " << positions.size() << " positions" << std::endl;
+    bench_evaluate<nnue::eval<float>>("float", weights, positions);
+    bench_evaluate<nnue::quantized_eval>("quantized", quantized_weights, positions);
+
+    const auto leaves = leaf_positions(positions);
+    std::cout << "fc0: " << leaves.size() << " leaf positions" << std::endl;
+    bench_fc0<nnue::eval<float>>("float", weights, weights.fc0, leaves);
+    bench_fc0<nnue::quantized_eval>("quantized", quantized_weights, quantized_weights.fc0, leaves);
+
+    std::cout << "architectures: update, then dense layers, by accumulator width" << std::endl;
+    std::apply([&](auto... archs) { (bench_architecture<decltype(archs)>(samples, positions), ...); },
+               nnue::architectures{});
+
+    std::cout << "half rows: fused update with flip rows, score drift from float over " << positions.size()
+              << " game positions" << std::endl;
+    std::apply([&](auto... archs) { (bench_half<decltype(archs)>(samples, positions), ...); }, nnue::architectures{});
+
+    const auto lines = random_lines();
+    std::cout << "ops: " << lines.size() << " lines of up to " << line_plies << " random moves, " << positions.size()
+              << " game positions" << std::endl;
+    bench_ops<nnue::eval<float>>("float", weights, positions, lines);
+    bench_ops<nnue::quantized_eval>("quantized", quantized_weights, positions, lines);
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "evalfile.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <libataxx/position.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../../../search/tryhard/tryhard.hpp"
+
+namespace UAI {
+
+namespace Extension {
+
+namespace {
+
+// Why fen isn't a position, or nullptr if it is. libataxx reads whatever it is given, so a malformed line
+// would be scored as some arbitrary position.
+const char *invalid_fen(const std::string &fen) {
+    if (fen == "startpos") {
+        return nullptr;
+    }
+
+    std::stringstream ss{fen};
+    std::string board;
+    std::string side;
+    if (!(ss >> board >> side)) {
+        return "expected a board and a side to move";
+    }
+
+    int ranks = 1;
+    int files = 0;
+    for (const char c : board) {
+        if (c == '/') {
+            if (files != 7) {
+                return "a rank doesn't have 7 squares";
+            }
+            ranks++;
+            files = 0;
+        } else if (c >= '1' && c <= '7') {
+            files += c - '0';
+        } else if (c == 'x' || c == 'o' || c == '-') {
+            files++;
+        } else {
+            return "unexpected character in the board";
+        }
+    }
+    if (ranks != 7 || files != 7) {
+        return "the board isn't 7 ranks of 7 squares";
+    }
+
+    if (side != "x" && side != "o") {
+        return "the side to move isn't x or o";
+    }
+
+    // The move counters are optional
+    std::string counter;
+    for (int i = 0; i < 2 && ss >> counter; ++i) {
+        if (counter.find_first_not_of("0123456789") != std::string::npos) {
+            return "a move counter isn't a number";
+        }
+    }
+    if (ss >> counter) {
+        return "unexpected text after the move counters";
+    }
+    return nullptr;
+}
+
+}  // namespace
+
+// Evaluate every FEN in a file with the network, many positions at a time
+// -- evalfile positions.txt
+// Prints "info score cp <score> fen <fen>" per position, in file order. Lines that aren't a FEN are reported and
+// skipped.
+template <typename Eval>
+void evalfile(std::stringstream &stream, const typename Eval::weights_type &weights) {
+    using Tryhard = search::tryhard::Tryhard<Eval>;
+    constexpr std::size_t chunk = 4096;
+
+    std::string path;
+    std::getline(stream >> std::ws, path);
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "info string evalfile can't open \"" << path << "\"" << std::endl;
+        return;
+    }
+
+    search::tryhard::RefreshCache<Eval> cache;
+    std::vector<std::string> fens;
+    std::vector<libataxx::Position> positions;
+    std::vector<int> scores;
+    std::size_t total = 0;
+    std::size_t line_number = 0;
+
+    const auto flush = [&]() {
+        scores.resize(positions.size());
+        Tryhard::eval(positions.data(), positions.size(), weights, cache, scores.data());
+        for (std::size_t i = 0; i < positions.size(); ++i) {
+            std::cout << "info score cp " << scores[i] << " fen " << fens[i] << "\n";
+        }
+        total += positions.size();
+        fens.clear();
+        positions.clear();
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::string line;
+    while (std::getline(file, line)) {
+        line_number++;
+        if (line.empty()) {
+            continue;
+        }
+
+        if (const char *reason = invalid_fen(line)) {
+            std::cout << "info string evalfile skipped line " << line_number << ": " << reason << "\n";
+            continue;
+        }
+        positions.emplace_back(line);
+        fens.push_back(line);
+
+        if (positions.size() == chunk) {
+            flush();
+        }
+    }
+    flush();
+    const auto finish = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> elapsed = finish - start;
+
+    std::cout << "info string evalfile positions " << total << " time " << static_cast<int>(elapsed.count() * 1000)
+              << " evals/s " << static_cast<std::uint64_t>(total / std::max(elapsed.count(), 1e-9)) << std::endl;
+}
+
+using search::tryhard::FloatEval;
+using search::tryhard::QuantizedEval;
+using search::tryhard::Bf16Eval;
+using search::tryhard::Fp16Eval;
+
+#define EVALFILE(Eval) template void evalfile<Eval>(std::stringstream &, const Eval::weights_type &);
+AUTAXX_FOR_EACH_EVAL(EVALFILE)
+#undef EVALFILE
+
+}  // namespace Extension
+
+}  // namespace UAI
@@ -0,0 +1,18 @@
+#ifndef UAI_EXTENSION_EVALFILE_HPP
+#define UAI_EXTENSION_EVALFILE_HPP
+
+#include <sstream>
+
+namespace UAI {
+
+namespace Extension {
+
+// Evaluate every FEN in a file with the network, many positions at a time
+template <typename Eval>
+void evalfile(std::stringstream &stream, const typename Eval::weights_type &weights);
+
+}  // namespace Extension
+
+}  // namespace UAI
+
+#endif
@@ -1,15 +1,21 @@
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <string>
 #include "../../options.hpp"
 #include "../../search/alphabeta/alphabeta.hpp"
 #include "../../search/leastcaptures/leastcaptures.hpp"
 #include "../../search/mcts/mcts.hpp"
+#include "../../search/mcts/nnue.hpp"
 #include "../../search/minimax/minimax.hpp"
 #include "../../search/mostcaptures/mostcaptures.hpp"
 #include "../../search/random/random.hpp"
+#include "../../search/tryhard/nnue_embedded.hpp"
+#include "../../search/tryhard/nnue_shared.hpp"
 #include "../../search/tryhard/tryhard.hpp"
 #include "../protocol.hpp"
 #include "extension/display.hpp"
+#include "extension/evalfile.hpp"
 #include "extension/perft.hpp"
 #include "extension/split.hpp"
 #include "go.hpp"
@@ -23,6 +29,144 @@ using namespace search;
 
 namespace UAI {
 
+namespace {
+
+// A network of one of the compiled in architectures, and everything that depends on its shape
+struct Network {
+    // Search with a transposition table and an eval cache of the given sizes in MB, and a lazy eval margin
+    std::function<std::unique_ptr<Search>(unsigned int, unsigned int, int)> tryhard;
+    // MCTS scoring its leaves with the network
+    std::function<std::unique_ptr<Search>()> mcts;
+    std::function<int(const libataxx::Position &)> eval;
+    std::function<void(std::stringstream &)> evalfile;
+};
+
+template <typename Eval>
+Network bind_network(const std::shared_ptr<const typename Eval::weights_type> &weights) {
+    // Accumulators of recent eval commands, which in analysis tend to be close to each other
+    const auto cache = std::make_shared<tryhard::RefreshCache<Eval>>();
+    return {
+        [weights](const unsigned int mb, const unsigned int eval_mb, const int lazy_margin) {
+            return std::unique_ptr<Search>(new tryhard::Tryhard<Eval>(mb, eval_mb, lazy_margin, *weights));
+        },
+        [weights]() { return std::unique_ptr<Search>(new mcts::NnueMCTS<Eval>(*weights)); },
+        [weights, cache](const libataxx::Position &pos) { return tryhard::Tryhard<Eval>::eval(pos, *weights, *cache); },
+        [weights](std::stringstream &stream) { Extension::evalfile<Eval>(stream, *weights); }};
+}
+
+// The weights made by load(), or with nnue-shared those of the shared object of the network, which only the first
+// process on the host has to load. Anything going wrong with shared memory leaves a private copy.
+template <typename Weights, typename Load>
+std::shared_ptr<const Weights> load_weights(const std::string &name,
+                                            const nnue::weights_mapping &mapping,
+                                            const std::string &precision,
+                                            Load &&load) {
+    if (!Options::checks["nnue-shared"].get()) {
+        return load();
+    }
+
+    const auto signature = nnue::file_signature(name, mapping);
+    const auto key = nnue::shared_name(precision, Weights::architecture_type::base_dim, signature);
+    auto payload = nnue::attach_shared(key);
+    std::shared_ptr<const Weights> loaded;
+    if (payload.data() == nullptr) {
+        loaded = load();
+        payload = nnue::create_shared(key, [&](nnue::weights_writer &ww) { loaded->share_(ww); });
+    }
+
+    if (payload.data() != nullptr) {
+        try {
+            auto attached = std::make_shared<Weights>();
+            attached->attach(nnue::weights_streamer(key, payload));
+            // The checksum of the object only vouches for it being written completely, not for what it holds
+            if (attached->signature() != signature) {
+                throw nnue::load_error("nnue " + key + ": holds another network");
+            }
+            std::cout << "info string nnue " << name << ": " << (loaded ? "shared as " : "attached to ") << key
+                      << std::endl;
+            return attached;
+        } catch (const nnue::load_error &e) {
+            std::cout << "info string " << e.what() << std::endl;
+        }
+    }
+
+    std::cout << "info string nnue " << name << ": can't share " << key << ", using a private copy" << std::endl;
+    return loaded ? loaded : load();
+}
+
+// Float weights with their feature transformer rows narrowed to Row, straight from the file
+template <typename Arch, typename Row>
+Network load_narrowed(const std::string &name, const nnue::weights_mapping &mapping, const std::string &precision) {
+    using Weights = nnue::weights<float, Arch, Row>;
+    return bind_network<nnue::eval<float, Arch, Row>>(load_weights<Weights>(name, mapping, precision, [&] {
+        auto weights = std::make_shared<Weights>();
+        weights->load(nnue::weights_streamer(name, mapping));
+        return weights;
+    }));
+}
+
+// The network of mapping at the requested precision, quantizing or narrowing a float network if needed
+template <typename Arch>
+Network load_architecture(const std::string &name, const nnue::weights_mapping &mapping, std::string &precision) {
+    using FloatWeights = nnue::weights<float, Arch>;
+    using QuantizedWeights = nnue::basic_quantized_weights<Arch>;
+
+    const bool quantized_file = nnue::file_element(name, mapping) == nnue::element_type::quantized;
+    if (quantized_file && precision != "quantized") {
+        std::cout << "info string nnue " << name << ": holds a quantized network, using quantized precision"
+                  << std::endl;
+        precision = "quantized";
+    }
+
+    const auto load_float = [&] {
+        auto weights = std::make_shared<FloatWeights>();
+        weights->load(nnue::weights_streamer(name, mapping));
+        return weights;
+    };
+
+    if (precision == "quantized") {
+        return bind_network<nnue::basic_quantized_eval<Arch>>(
+            load_weights<QuantizedWeights>(name, mapping, precision, [&] {
+                auto weights = std::make_shared<QuantizedWeights>();
+                if (quantized_file) {
+                    weights->load(nnue::weights_streamer(name, mapping));
+                } else {
+                    weights->quantize(*load_float());
+                }
+                return weights;
+            }));
+    } else if (precision == "bf16") {
+        return load_narrowed<Arch, nnue::bf16>(name, mapping, precision);
+    } else if (precision == "fp16") {
+        return load_narrowed<Arch, nnue::fp16>(name, mapping, precision);
+    }
+    return bind_network<nnue::eval<float, Arch>>(load_weights<FloatWeights>(name, mapping, precision, load_float));
+}
+
+// Load a network of any compiled in architecture at any nnue-precision, reporting any problem with it.
+// A quantized file forces quantized precision.
+bool load_network(const std::string &name,
+                  const nnue::weights_mapping &mapping,
+                  std::string &precision,
+                  Network &network) {
+    try {
+        const auto dims = nnue::file_dimensions(name, mapping, nnue::default_architecture::dims);
+        const bool found = nnue::with_architecture(dims, [&](auto arch) {
+            network = load_architecture<decltype(arch)>(name, mapping, precision);
+            std::cout << "info string nnue " << name << ": accumulators " << arch.base_dim << " wide" << std::endl;
+        });
+        if (!found) {
+            throw nnue::load_error("nnue " + name + ": no architecture of this build has its layer dimensions");
+        }
+        return true;
+    } catch (const nnue::load_error &e) {
+        std::cout << "info string " << e.what() << std::endl;
+        return false;
+    }
+}
+
+}  // namespace
+
 // Communicate with the UAI protocol (Universal Ataxx Interface)
 // Based on the UCI protocol (Universal Chess Interface)
 void listen() {
@@ -32,7 +176,13 @@ void listen() {
     // Create options
     Options::checks["debug"] = Options::Check(false);
     Options::spins["hash"] = Options::Spin(1, 2048, 128);
-    Options::strings["nnue-path"] = Options::String("./save.bin");
+    Options::spins["eval-hash"] = Options::Spin(0, 1024, 1);
+    Options::spins["lazy-margin"] = Options::Spin(0, 10000, 0);
+    const auto embedded = nnue::embedded_network();
+    Options::strings["nnue-path"] = Options::String(embedded.data() ? "" : "./save.bin");
+    Options::combos["nnue-precision"] = Options::Combo("float", {"float", "bf16", "fp16", "quantized"});
+    Options::checks["nnue-shared"] = Options::Check(false);
+    Options::combos["mcts-eval"] = Options::Combo("nnue", {"nnue", "classical"});
     Options::combos["search"] = Options::Combo("tryhard",
                                                {
                                                    "tryhard",
@@ -67,7 +217,30 @@ void listen() {
         }
     }
 
-    const auto weights = nnue::weights<float>{}.load(Options::strings["nnue-path"].get());
+    // Load the network from nnue-path, falling back to the embedded network if there is no usable file.
+    // Problems are reported and, with nothing else to use, leave an empty network.
+    const auto path = Options::strings["nnue-path"].get();
+    auto precision = Options::combos["nnue-precision"].get();
+    Network network;
+    bool loaded = false;
+    if (!path.empty()) {
+        loaded = load_network(path, nnue::weights_mapping(path), precision, network);
+    }
+    if (!loaded && embedded.data() != nullptr) {
+        std::cout << "info string nnue using the embedded network" << std::endl;
+        loaded = load_network("<embedded>", embedded, precision, network);
+    }
+    if (!loaded) {
+        std::cout << "info string nnue no network loaded, evaluating with an empty network" << std::endl;
+        const auto weights = std::make_shared<nnue::weights<float>>();
+        if (precision == "quantized") {
+            auto quantized_weights = std::make_shared<nnue::quantized_weights>();
+            quantized_weights->quantize(*weights);
+            network = bind_network<nnue::quantized_eval>(quantized_weights);
+        } else {
+            network = bind_network<nnue::eval<float>>(weights);
+        }
+    }
 
     // Set search type
     if (Options::combos["search"].get() == "random") {
@@ -75,9 +248,15 @@ void listen() {
     } else if (Options::combos["search"].get() == "mostcaptures") {
         search_main = std::unique_ptr<Search>(new mostcaptures::MostCaptures());
     } else if (Options::combos["search"].get() == "tryhard") {
-        search_main = std::unique_ptr<Search>(new tryhard::Tryhard(Options::spins["hash"].get(), weights));
+        search_main = network.tryhard(Options::spins["hash"].get(),
+                                      Options::spins["eval-hash"].get(),
+                                      Options::spins["lazy-margin"].get());
     } else if (Options::combos["search"].get() == "mcts") {
-        search_main = std::unique_ptr<Search>(new mcts::MCTS());
+        if (Options::combos["mcts-eval"].get() == "classical") {
+            search_main = std::unique_ptr<Search>(new mcts::MCTS());
+        } else {
+            search_main = network.mcts();
+        }
     } else if (Options::combos["search"].get() == "minimax") {
         search_main = std::unique_ptr<Search>(new minimax::Minimax());
     } else if (Options::combos["search"].get() == "alphabeta") {
@@ -89,6 +268,7 @@ void listen() {
     libataxx::Position pos;
     uainewgame(pos);
 
+    std::cout << "info string simd " << nnue::simd::name(nnue::simd::active.isa) << std::endl;
     isready();
 
     // isready received, now we're ready to do something
@@ -115,8 +295,9 @@ void listen() {
         } else if (word == "stop") {
             stop();
         } else if (word == "eval") {
-            const auto e = search::tryhard::Tryhard::eval(pos, weights);
-            std::cout << "info score cp " << e << "\n";
+            std::cout << "info score cp " << network.eval(pos) << "\n";
+        } else if (word == "evalfile") {
+            network.evalfile(stream);
         } else if (word == "print") {
             Extension::display(pos);
         } else if (word == "display") {
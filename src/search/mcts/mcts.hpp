@@ -1,13 +1,17 @@
 #ifndef SEARCH_MCTS_HPP
 #define SEARCH_MCTS_HPP
 
+#include <libataxx/move.hpp>
 #include <libataxx/position.hpp>
 #include "../search.hpp"
+#include "eval.hpp"
+#include "node.hpp"
 
 namespace search {
 
 namespace mcts {
 
+// Scores leaves with the classical eval, subclasses bring their own through the hooks below
 class MCTS : public Search {
    public:
     void go(const libataxx::Position pos, const Settings &settings) override {
@@ -15,6 +19,20 @@ class MCTS : public Search {
         search_thread_ = std::thread(&MCTS::root, this, pos, settings);
     }
 
+   protected:
+    // A new tree is searched from pos
+    virtual void set_root(const libataxx::Position &) noexcept {
+    }
+
+    // The tree policy plays move in pos to reach node, which is ply moves from the root
+    virtual void descend(const int, const Node *, const libataxx::Position &, const libataxx::Move &) noexcept {
+    }
+
+    // Score for the side to move of the leaf reached last, ply moves from the root. The game isn't over in pos.
+    [[nodiscard]] virtual int evaluate(const int, const libataxx::Position &pos) noexcept {
+        return eval(pos);
+    }
+
    private:
     void root(const libataxx::Position pos, const Settings &settings) noexcept;
 };
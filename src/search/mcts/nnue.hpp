@@ -0,0 +1,112 @@
+#ifndef SEARCH_MCTS_NNUE_HPP
+#define SEARCH_MCTS_NNUE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <libataxx/move.hpp>
+#include <libataxx/position.hpp>
+#include <vector>
+#include "../tryhard/tryhard.hpp"
+#include "mcts.hpp"
+#include "node.hpp"
+
+namespace search::mcts {
+
+// Accumulators of the network for each ply of the selection path. Consecutive playouts share the top of the
+// tree, so only the plies below the node where a path leaves the previous one are updated.
+template <typename Eval>
+class NnueLeaf {
+   public:
+    using weights_type = typename Eval::weights_type;
+
+    explicit NnueLeaf(const weights_type &weights) : weights_{&weights}, accumulators_(1, Eval{&weights}) {
+    }
+
+    void set_root(const libataxx::Position &pos) noexcept {
+        nnue::feature_delta white;
+        nnue::feature_delta black;
+        tryhard::Tryhard<Eval>::position_delta(pos, white, black);
+        accumulators_[0].white.refresh(white);
+        accumulators_[0].black.refresh(black);
+        path_.assign(1, Step{});
+        valid_ = 0;
+    }
+
+    // Record the move leading to node at ply, played in pos
+    void descend(const int ply, const Node *node, const libataxx::Position &pos, const libataxx::Move &move) {
+        if (ply >= static_cast<int>(path_.size())) {
+            path_.resize(ply + 1);
+            accumulators_.resize(ply + 1, Eval{weights_});
+        }
+        if (path_[ply].node != node) {
+            path_[ply] = Step{node, move, pos.them(), pos.turn()};
+            valid_ = std::min(valid_, ply - 1);
+        }
+    }
+
+    // Score of pos, the position at ply of the path, for the side to move
+    [[nodiscard]] int evaluate(const int ply, const libataxx::Position &pos) noexcept {
+        for (int i = valid_ + 1; i <= ply; ++i) {
+            nnue::feature_delta white;
+            nnue::feature_delta black;
+            tryhard::Tryhard<Eval>::move_delta(path_[i].turn, path_[i].them, path_[i].move, white, black);
+            accumulators_[i].white.update(accumulators_[i - 1].white, white);
+            accumulators_[i].black.update(accumulators_[i - 1].black, black);
+            updates_++;
+        }
+        valid_ = ply;
+        return accumulators_[ply].evaluate(static_cast<bool>(pos.turn()));
+    }
+
+    // Accumulator updates so far, one per ply brought up to date
+    [[nodiscard]] std::uint64_t updates() const noexcept {
+        return updates_;
+    }
+
+   private:
+    // A node of the path and the move into it, with what move_delta needs of the position before it
+    struct Step {
+        const Node *node = nullptr;
+        libataxx::Move move;
+        libataxx::Bitboard them;
+        libataxx::Side turn;
+    };
+
+    const weights_type *weights_;
+    std::vector<Eval> accumulators_;
+    std::vector<Step> path_;
+    // Accumulators of plies up to valid_ belong to the nodes in path_
+    int valid_ = 0;
+    std::uint64_t updates_ = 0;
+};
+
+// MCTS scoring leaves with the network
+template <typename Eval>
+class NnueMCTS : public MCTS {
+   public:
+    explicit NnueMCTS(const typename Eval::weights_type &weights) : leaf_{weights} {
+    }
+
+   protected:
+    void set_root(const libataxx::Position &pos) noexcept override {
+        leaf_.set_root(pos);
+    }
+
+    void descend(const int ply,
+                 const Node *node,
+                 const libataxx::Position &pos,
+                 const libataxx::Move &move) noexcept override {
+        leaf_.descend(ply, node, pos, move);
+    }
+
+    [[nodiscard]] int evaluate(const int ply, const libataxx::Position &pos) noexcept override {
+        return leaf_.evaluate(ply, pos);
+    }
+
+   private:
+    NnueLeaf<Eval> leaf_;
+};
+
+}  // namespace search::mcts
+
+#endif
@@ -13,18 +13,22 @@ float sigmoid(const float score, const float k = 1.13) {
     return 1.0f / (1.0f + std::pow(10.0f, -k * score / 400.0f));
 }
 
-Node *tree_policy(Node *n, libataxx::Position &pos) {
+// descend(ply, node, pos, move) is called before each move down the tree is played
+template <typename F>
+Node *tree_policy(Node *n, libataxx::Position &pos, int &ply, F &&descend) {
     assert(n);
 
     while (!n->terminal()) {
         if (n->expandable()) {
             n = n->expand(pos);
             assert(pos.legal_move(n->move()));
+            descend(++ply, n, pos, n->move());
             pos.makemove(n->move());
             return n;
         } else {
             const int idx = n->best_scoring_child();
             assert(pos.legal_move(n->child(idx)->move()));
+            descend(++ply, n->child(idx), pos, n->child(idx)->move());
             pos.makemove(n->child(idx)->move());
             n = n->child(idx);
         }
@@ -32,7 +36,9 @@ Node *tree_policy(Node *n, libataxx::Position &pos) {
     return n;
 }
 
-float default_policy(const libataxx::Position &pos) {
+// eval() is only called if the game isn't over
+template <typename F>
+float default_policy(const libataxx::Position &pos, F &&eval) {
     float score = 0.5f;
 
     switch (pos.result()) {
@@ -44,7 +50,7 @@ float default_policy(const libataxx::Position &pos) {
             score = 0.5f;
             break;
         case libataxx::Result::None:
-            score = sigmoid(0.1 * eval(pos));
+            score = sigmoid(0.1 * eval());
             break;
         default:
             abort();
@@ -237,11 +243,16 @@ void MCTS::root(const libataxx::Position pos,
     }
 
     Node root{pos};
+    set_root(pos);
 
     while (true) {
         auto npos = pos;
-        Node *selection = tree_policy(&root, npos);
-        const auto reward = default_policy(npos);
+        int ply = 0;
+        Node *selection = tree_policy(
+            &root, npos, ply, [this](const int p, const Node *n, const libataxx::Position &before, const auto &move) {
+                descend(p, n, before, move);
+            });
+        const auto reward = default_policy(npos, [this, ply, &npos]() { return evaluate(ply, npos); });
         backup_negamax(selection, reward);
 
         stats_.nodes++;
@@ -38,6 +38,11 @@ struct Stats {
     void clear() {
         nodes = 0;
         tthits = 0;
+        nnue_updates = 0;
+        nnue_applied = 0;
+        eval_probes = 0;
+        eval_hits = 0;
+        lazy_evals = 0;
         seldepth = 0;
 #ifndef NDEBUG
         std::memset(cutoffs, 0, libataxx::max_moves * sizeof(std::uint64_t));
@@ -45,6 +50,14 @@ struct Stats {
     }
     std::uint64_t nodes = 0;
     std::uint64_t tthits = 0;
+    // Accumulator updates requested by the search, and those actually applied
+    std::uint64_t nnue_updates = 0;
+    std::uint64_t nnue_applied = 0;
+    // Static evaluations asked for, and those answered by the eval cache
+    std::uint64_t eval_probes = 0;
+    std::uint64_t eval_hits = 0;
+    // Static evaluations answered by the classical eval, see tryhard::lazy_cutoff
+    std::uint64_t lazy_evals = 0;
     int seldepth = 0;
 #ifndef NDEBUG
     std::uint64_t cutoffs[libataxx::max_moves] = {};
@@ -61,7 +61,7 @@ constexpr Score hole_penalties[] = {
 }
 
 // Return the evaluation of the position from the side to move's point of view
-int Tryhard::classical(const libataxx::Position &pos) noexcept {
+int classical(const libataxx::Position &pos) noexcept {
     const auto p = phase(pos);
     Score score;
 
@@ -0,0 +1,91 @@
+#ifndef SEARCH_TRYHARD_EVAL_CACHE_HPP
+#define SEARCH_TRYHARD_EVAL_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace search {
+
+namespace tryhard {
+
+// Static evaluations of recently seen positions, keyed by their hash, which covers the side to move.
+// Each entry is one word, the upper 48 bits of the hash above the score, so it is read and written whole
+// without a lock and a torn entry can't exist. Positions collide on the same slot and simply replace each other.
+class EvalCache {
+   public:
+    static constexpr int score_bits = 16;
+    static constexpr std::uint64_t score_mask = (std::uint64_t{1} << score_bits) - 1;
+
+    // A size of 0 turns the cache off
+    explicit EvalCache(const unsigned int mb) {
+        resize(mb);
+    }
+
+    // Round down to a power of two entries so the index is a mask
+    void resize(const unsigned int mb) {
+        const std::uint64_t wanted = (std::uint64_t{mb} * 1024 * 1024) / sizeof(std::uint64_t);
+        std::uint64_t n = wanted == 0 ? 0 : 1;
+        while (n != 0 && 2 * n <= wanted) {
+            n *= 2;
+        }
+        entries_ = n == 0 ? nullptr : std::make_unique<std::atomic<std::uint64_t>[]>(n);
+        size_ = n;
+        mask_ = n == 0 ? 0 : n - 1;
+        clear();
+    }
+
+    void clear() noexcept {
+        for (std::uint64_t i = 0; i < size_; ++i) {
+            entries_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    [[nodiscard]] bool enabled() const noexcept {
+        return size_ != 0;
+    }
+
+    [[nodiscard]] std::uint64_t size() const noexcept {
+        return size_;
+    }
+
+    // Start loading the entry of hash, so a probe shortly after doesn't wait on memory
+    void prefetch(const std::uint64_t hash) const noexcept {
+        if (enabled()) {
+            __builtin_prefetch(&entries_[hash & mask_]);
+        }
+    }
+
+    // True and the score of hash if it is in the cache
+    [[nodiscard]] bool probe(const std::uint64_t hash, int &score) const noexcept {
+        if (!enabled()) {
+            return false;
+        }
+        const std::uint64_t entry = entries_[hash & mask_].load(std::memory_order_relaxed);
+        if (((entry ^ hash) & ~score_mask) != 0) {
+            return false;
+        }
+        score = static_cast<std::int16_t>(entry & score_mask);
+        return true;
+    }
+
+    // Scores outside of 16 bits are left out rather than truncated
+    void store(const std::uint64_t hash, const int score) noexcept {
+        if (!enabled() || score < INT16_MIN || score > INT16_MAX) {
+            return;
+        }
+        const auto bits = static_cast<std::uint16_t>(static_cast<std::int16_t>(score));
+        entries_[hash & mask_].store((hash & ~score_mask) | bits, std::memory_order_relaxed);
+    }
+
+   private:
+    std::unique_ptr<std::atomic<std::uint64_t>[]> entries_;
+    std::uint64_t size_ = 0;
+    std::uint64_t mask_ = 0;
+};
+
+}  // namespace tryhard
+
+}  // namespace search
+
+#endif
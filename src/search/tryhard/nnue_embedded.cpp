@@ -0,0 +1,28 @@
+#include "nnue_embedded.hpp"
+
+#ifdef NNUE_EMBED_PATH
+// The file is pulled in by the assembler, so the compiler never has to parse it as a giant array
+asm(".section .rodata\n"
+    ".balign 64\n"
+    ".global nnue_embedded_begin\n"
+    "nnue_embedded_begin:\n"
+    ".incbin \"" NNUE_EMBED_PATH "\"\n"
+    ".global nnue_embedded_end\n"
+    "nnue_embedded_end:\n"
+    ".previous\n");
+
+extern "C" const char nnue_embedded_begin[];
+extern "C" const char nnue_embedded_end[];
+#endif
+
+namespace nnue {
+
+weights_mapping embedded_network() {
+#ifdef NNUE_EMBED_PATH
+    return weights_mapping(nnue_embedded_begin, static_cast<size_t>(nnue_embedded_end - nnue_embedded_begin));
+#else
+    return weights_mapping{};
+#endif
+}
+
+}  // namespace nnue
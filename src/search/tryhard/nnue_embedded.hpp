@@ -0,0 +1,11 @@
+#pragma once
+
+#include "weights_streamer.hpp"
+
+namespace nnue {
+
+// Network compiled into the binary with -DNNUE_EMBED=<file>, or an empty mapping without one.
+// The bytes are 64 byte aligned, so the feature transformers can point straight at them.
+weights_mapping embedded_network();
+
+}  // namespace nnue
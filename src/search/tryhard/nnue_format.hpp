@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace nnue {
+
+// Thrown for any network file that can't be used as is. The message names the file and the problem.
+struct load_error : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// XXH64 (https://github.com/Cyan4973/xxHash), used to checksum the payload of a network file
+namespace xxh64 {
+
+constexpr std::uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+constexpr std::uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr std::uint64_t prime3 = 0x165667B19E3779F9ULL;
+constexpr std::uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr std::uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+constexpr std::uint64_t rotl(const std::uint64_t x, const int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+constexpr std::uint64_t round(std::uint64_t acc, const std::uint64_t input) {
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+constexpr std::uint64_t merge_round(std::uint64_t acc, const std::uint64_t val) {
+    acc ^= round(0, val);
+    return acc * prime1 + prime4;
+}
+
+inline std::uint64_t read64(const char* p) {
+    std::uint64_t x;
+    std::memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+inline std::uint32_t read32(const char* p) {
+    std::uint32_t x;
+    std::memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+inline std::uint64_t hash(const char* p, const size_t size, const std::uint64_t seed = 0) {
+    const char* const end = p + size;
+    std::uint64_t h;
+
+    if (size >= 32) {
+        std::uint64_t v1 = seed + prime1 + prime2;
+        std::uint64_t v2 = seed + prime2;
+        std::uint64_t v3 = seed;
+        std::uint64_t v4 = seed - prime1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    } else {
+        h = seed + prime5;
+    }
+
+    h += static_cast<std::uint64_t>(size);
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * prime1 + prime4;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<std::uint64_t>(read32(p)) * prime1;
+        h = rotl(h, 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= static_cast<std::uint64_t>(static_cast<unsigned char>(*p)) * prime5;
+        h = rotl(h, 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+}  // namespace xxh64
+
+enum class element_type : std::uint32_t
+{
+    f32 = 1,
+    // int16 feature transformer, int8 dense weights with int32 biases
+    quantized = 2
+};
+
+template <typename T>
+constexpr element_type element_of() {
+    static_assert(std::is_same_v<T, float>, "only float networks have a file format");
+    return element_type::f32;
+}
+
+inline const char* name(const element_type element) {
+    switch (element) {
+        case element_type::f32:
+            return "float";
+        case element_type::quantized:
+            return "quantized";
+        default:
+            return "unknown";
+    }
+}
+
+// Alignment of every weight and activation buffer, so vector loads never split a cache line
+constexpr size_t cache_line = 64;
+
+constexpr char file_magic[8] = {'A', 'T', 'X', 'N', 'N', 'U', 'E', '\0'};
+constexpr std::uint32_t file_version = 1;
+
+// Layer dimensions of a network, in file order
+struct file_dims {
+    std::uint32_t half_ka_numel;
+    std::uint32_t base_dim;
+    std::uint32_t fc0_in;
+    std::uint32_t fc0_out;
+    std::uint32_t fc1_in;
+    std::uint32_t fc1_out;
+    std::uint32_t fc2_in;
+    std::uint32_t fc2_out;
+
+    bool operator==(const file_dims& other) const {
+        return std::memcmp(this, &other, sizeof(file_dims)) == 0;
+    }
+};
+
+// Little endian header in front of the payload. The payload is every parameter in load order, so it starts
+// 128 bytes into the file and keeps the alignment of the mapping.
+struct file_header {
+    char magic[8];
+    std::uint32_t version;
+    element_type element;
+    file_dims dims;
+    // Rescaling of a quantized network, see quantized_weights. Unused for float networks.
+    std::int32_t fc0_shift;
+    std::int32_t fc1_shift;
+    float output_scale;
+    std::uint32_t reserved0;
+    std::uint64_t payload_bytes;
+    std::uint64_t payload_hash;
+    std::uint8_t reserved1[48];
+};
+
+static_assert(sizeof(file_header) == 128 && sizeof(file_header) % cache_line == 0,
+              "file_header must keep the payload aligned");
+
+inline bool has_header(const char* data, const size_t size) {
+    return size >= sizeof(file_header) && std::memcmp(data, file_magic, sizeof(file_magic)) == 0;
+}
+
+// Check a network file against what the caller expects and return its header.
+// Files without a header are the legacy raw float format, accepted only if their size is exactly legacy_bytes.
+inline file_header read_header(const std::string& path,
+                               const char* data,
+                               const size_t size,
+                               const element_type element,
+                               const file_dims& dims,
+                               const size_t payload_bytes,
+                               const size_t legacy_bytes) {
+    if (data == nullptr) {
+        throw load_error("nnue " + path + ": can't read the file");
+    }
+
+    file_header header{};
+    if (!has_header(data, size)) {
+        if (legacy_bytes == 0 || size != legacy_bytes) {
+            throw load_error("nnue " + path + ": no header and " + std::to_string(size) +
+                             " bytes, a legacy network has " + std::to_string(legacy_bytes));
+        }
+        std::memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version = 0;
+        header.element = element_type::f32;
+        header.dims = dims;
+        header.output_scale = 1.0f;
+        header.payload_bytes = size;
+        header.payload_hash = xxh64::hash(data, size);
+        return header;
+    }
+
+    std::memcpy(&header, data, sizeof(file_header));
+    if (header.version != file_version) {
+        throw load_error("nnue " + path + ": unsupported format version " + std::to_string(header.version));
+    }
+    if (header.element != element) {
+        throw load_error("nnue " + path + ": holds a " + name(header.element) + " network, expected " +
+                         name(element));
+    }
+    if (!(header.dims == dims)) {
+        throw load_error("nnue " + path + ": layer dimensions don't match this build");
+    }
+    if (header.payload_bytes != payload_bytes || size - sizeof(file_header) != payload_bytes) {
+        throw load_error("nnue " + path + ": expected " + std::to_string(payload_bytes) +
+                         " bytes of parameters, found " + std::to_string(size - sizeof(file_header)));
+    }
+    if (xxh64::hash(data + sizeof(file_header), payload_bytes) != header.payload_hash) {
+        throw load_error("nnue " + path + ": checksum mismatch");
+    }
+    return header;
+}
+
+// Collects the payload of a network in load order, then writes it behind its header
+struct weights_writer {
+    std::string payload_{};
+
+    template <typename U>
+    weights_writer& write(const U* src, const size_t numel) {
+        payload_.append(reinterpret_cast<const char*>(src), numel * sizeof(U));
+        return *this;
+    }
+
+    void save(const std::string& path, file_header header) const {
+        std::memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version = file_version;
+        header.payload_bytes = payload_.size();
+        header.payload_hash = xxh64::hash(payload_.data(), payload_.size());
+
+        std::ofstream file(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(file_header));
+        file.write(payload_.data(), payload_.size());
+        if (!file) {
+            throw load_error("nnue " + path + ": can't write the file");
+        }
+    }
+};
+
+}  // namespace nnue
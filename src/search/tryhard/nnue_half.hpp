@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace nnue {
+
+// 16 bit storage formats for float feature transformer rows, halving the bytes an accumulator update reads.
+// Rows are narrowed once at load time, rounding to nearest even, and widened back to float in the update
+// kernels, so the accumulators themselves stay float.
+
+namespace detail {
+
+inline std::uint32_t float_bits(const float x) {
+    std::uint32_t u;
+    std::memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+inline float bits_float(const std::uint32_t u) {
+    float x;
+    std::memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+}  // namespace detail
+
+// The upper half of a float: its range, with 8 bits of mantissa
+struct bf16 {
+    std::uint16_t bits;
+
+    static bf16 from(const float x) {
+        const std::uint32_t u = detail::float_bits(x);
+        return {static_cast<std::uint16_t>((u + 0x7FFF + ((u >> 16) & 1)) >> 16)};
+    }
+
+    explicit operator float() const {
+        return detail::bits_float(std::uint32_t{bits} << 16);
+    }
+};
+
+// IEEE binary16: 11 bits of mantissa, magnitudes up to 65504 and normal down to 2^-14
+struct fp16 {
+    std::uint16_t bits;
+
+    // See https://gist.github.com/rygorous/2156668, float_to_half_fast3_rtne
+    static fp16 from(const float x) {
+        constexpr std::uint32_t f32_inf = 255u << 23;
+        constexpr std::uint32_t f16_max = (127u + 16) << 23;
+        constexpr std::uint32_t denorm_magic = ((127u - 15) + (23 - 10) + 1) << 23;
+
+        std::uint32_t u = detail::float_bits(x);
+        const std::uint32_t sign = u & 0x80000000u;
+        u ^= sign;
+
+        std::uint32_t h;
+        if (u >= f16_max) {
+            h = u > f32_inf ? 0x7E00 : 0x7C00;
+        } else if (u < (113u << 23)) {
+            // Subnormal or zero: float addition lines the mantissa up and rounds it
+            h = detail::float_bits(detail::bits_float(u) + detail::bits_float(denorm_magic)) - denorm_magic;
+        } else {
+            const std::uint32_t odd = (u >> 13) & 1;
+            u += ((15u - 127) << 23) + 0xFFF + odd;
+            h = u >> 13;
+        }
+        return {static_cast<std::uint16_t>(h | (sign >> 16))};
+    }
+
+    explicit operator float() const {
+        constexpr std::uint32_t shifted_exp = 0x7C00u << 13;
+        std::uint32_t u = (std::uint32_t{bits} & 0x7FFF) << 13;
+        const std::uint32_t exp = u & shifted_exp;
+        u += (127u - 15) << 23;
+        if (exp == shifted_exp) {
+            u += (128u - 16) << 23;
+        } else if (exp == 0) {
+            u += 1u << 23;
+            u = detail::float_bits(detail::bits_float(u) - detail::bits_float(113u << 23));
+        }
+        return detail::bits_float(u | ((std::uint32_t{bits} & 0x8000) << 16));
+    }
+};
+
+}  // namespace nnue
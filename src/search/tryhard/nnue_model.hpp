@@ -1,26 +1,87 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "nnue_format.hpp"
 #include "nnue_util.hpp"
 #include "weights_streamer.hpp"
 
 namespace nnue {
 
+// Features of every architecture: a "us" and a "them" stone for each square
 constexpr size_t half_ka_numel = 49 * 2;
-constexpr size_t base_dim = 32;
 
-template <typename T>
+// Layer sizes of a network. The accumulators are base_dim wide, followed by the hidden layers fc0 and fc1 and
+// the output layer fc2, which sees the outputs of both fc0 and fc1.
+template <size_t BaseDim, size_t Fc0Dim = 32, size_t Fc1Dim = 32>
+struct architecture {
+    static constexpr size_t base_dim = BaseDim;
+    static constexpr size_t fc0_dim = Fc0Dim;
+    static constexpr size_t fc1_dim = Fc1Dim;
+    static constexpr size_t fc2_in = Fc0Dim + Fc1Dim;
+    static constexpr file_dims dims = {half_ka_numel, BaseDim, 2 * BaseDim, Fc0Dim, Fc0Dim, Fc1Dim, fc2_in, 1};
+};
+
+using default_architecture = architecture<32>;
+
+// Accumulator widths of the architectures compiled in, as X(A, base_dim) for each. Adding a width here is all it
+// takes, the explicit instantiations of the search use the same list, see AUTAXX_FOR_EACH_EVAL.
+#define AUTAXX_FOR_EACH_WIDTH(X, A) X(A, 32) X(A, 64) X(A, 128) X(A, 256)
+
+namespace detail {
+
+#define AUTAXX_WIDTH(A, dim) dim,
+constexpr size_t widths[] = {AUTAXX_FOR_EACH_WIDTH(AUTAXX_WIDTH, )};
+#undef AUTAXX_WIDTH
+
+template <size_t... I>
+std::tuple<architecture<widths[I]>...> architectures_of(std::index_sequence<I...>);
+
+}  // namespace detail
+
+// Architectures compiled in, a network file picks one with its layer dimensions
+using architectures = decltype(detail::architectures_of(std::make_index_sequence<std::size(detail::widths)>{}));
+
+// Call f(Arch{}) for the compiled in architecture with these dimensions, returning false if there is none
+template <typename F>
+bool with_architecture(const file_dims& dims, F&& f) {
+    return std::apply([&](const auto... archs) { return ((archs.dims == dims && (f(archs), true)) || ...); },
+                      architectures{});
+}
+
+// Accumulator width of the default architecture
+constexpr size_t base_dim = default_architecture::base_dim;
+
+// Positions per pass of evaluate_batch, which bounds its scratch space on the stack
+constexpr size_t eval_batch_size = 64;
+
+// Feature index of the flip row of sq, see big_affine
+constexpr size_t flip_idx(const size_t sq) {
+    return big_affine<float, half_ka_numel, base_dim>::flip_idx(sq);
+}
+
+// Row is the storage type of the feature transformer rows, see big_affine
+template <typename T, typename Arch = default_architecture, typename Row = T>
 struct weights {
-    typename weights_streamer<T>::signature_type signature_{0};
-    big_affine<T, half_ka_numel, base_dim> w{};
-    big_affine<T, half_ka_numel, base_dim> b{};
-    stack_affine<T, 2 * base_dim, 32> fc0{};
-    stack_affine<T, 32, 32> fc1{};
-    stack_affine<T, 64, 1> fc2{};
+    using architecture_type = Arch;
+    using row_type = Row;
+    static constexpr file_dims dims = Arch::dims;
 
+    std::uint64_t hash_{0};
+    big_affine<T, half_ka_numel, Arch::base_dim, Row> w{};
+    big_affine<T, half_ka_numel, Arch::base_dim, Row> b{};
+    stack_affine<T, 2 * Arch::base_dim, Arch::fc0_dim> fc0{};
+    stack_affine<T, Arch::fc0_dim, Arch::fc1_dim> fc1{};
+    stack_affine<T, Arch::fc2_in, 1> fc2{};
+
+    // xxh64 of the parameters as stored in the file
     size_t signature() const {
-        return signature_;
+        return hash_;
     }
 
     size_t num_parameters() const {
@@ -28,33 +89,109 @@ struct weights {
                fc2.num_parameters();
     }
 
-    weights<T>& load(weights_streamer<T>& ws) {
+    // Parameters in file order, read from wherever ws is
+    weights<T, Arch, Row>& load_(weights_streamer& ws) {
         w.load_(ws);
         b.load_(ws);
         fc0.load_(ws);
         fc1.load_(ws);
         fc2.load_(ws);
-        signature_ = ws.signature();
         return *this;
     }
 
-    weights<T>& load(const std::string& path) {
-        auto ws = weights_streamer<T>(path);
-        return load(ws);
+    // Throws load_error unless path holds a network of this shape, with a header or in the legacy raw format
+    weights<T, Arch, Row>& load(const std::string& path) {
+        return load(weights_streamer(path));
+    }
+
+    weights<T, Arch, Row>& load(weights_streamer&& ws) {
+        // Only the default architecture existed before the header, so only it can be a legacy file
+        const size_t payload_bytes = sizeof(T) * num_parameters();
+        const size_t legacy_bytes = std::is_same_v<Arch, default_architecture> ? payload_bytes : 0;
+        hash_ = ws.open(element_of<T>(), dims, payload_bytes, legacy_bytes).payload_hash;
+        return load_(ws);
+    }
+
+    // src with the feature transformer rows narrowed to Row
+    weights<T, Arch, Row>& narrow(const weights<T, Arch>& src) {
+        w.narrow_(src.w);
+        b.narrow_(src.b);
+        fc0 = src.fc0;
+        fc1 = src.fc1;
+        fc2 = src.fc2;
+        hash_ = src.hash_;
+        return *this;
+    }
+
+    // Everything evaluation reads, flip rows included, in the layout of attach(). See create_shared.
+    void share_(weights_writer& ww) const {
+        w.share_(ww);
+        b.share_(ww);
+        fc0.save_(ww);
+        fc1.save_(ww);
+        fc2.save_(ww);
+        ww.write(&hash_, 1);
+    }
+
+    // Use what share_() wrote, borrowing the feature transformers in place
+    weights<T, Arch, Row>& attach(weights_streamer&& ws) {
+        w.attach_(ws);
+        b.attach_(ws);
+        fc0.load_(ws);
+        fc1.load_(ws);
+        fc2.load_(ws);
+        ws.stream(&hash_, 1);
+        return *this;
+    }
+
+    void save(const std::string& path) const {
+        weights_writer ww;
+        w.save_(ww);
+        b.save_(ww);
+        fc0.save_(ww);
+        fc1.save_(ww);
+        fc2.save_(ww);
+
+        file_header header{};
+        header.element = element_of<T>();
+        header.dims = dims;
+        header.output_scale = 1.0f;
+        ww.save(path, header);
     }
 };
 
-template <typename T>
+// Features entering and leaving an accumulator, applied together by feature_transformer::update
+struct feature_delta {
+    static constexpr size_t capacity = half_ka_numel / 2;
+
+    // Only the first num_added and num_removed entries are set, this is built for every move
+    size_t added[capacity];
+    size_t removed[capacity];
+    size_t num_added{0};
+    size_t num_removed{0};
+
+    void add(const size_t idx) {
+        added[num_added++] = idx;
+    }
+
+    void remove(const size_t idx) {
+        removed[num_removed++] = idx;
+    }
+};
+
+template <typename T, typename Arch = default_architecture, typename Row = T>
 struct feature_transformer {
-    const big_affine<T, half_ka_numel, base_dim>* weights_;
-    stack_vector<T, base_dim> active_;
+    static constexpr size_t dim = Arch::base_dim;
+
+    const big_affine<T, half_ka_numel, dim, Row>* weights_;
+    stack_vector<T, dim> active_;
 
-    constexpr stack_vector<T, base_dim> active() const {
+    constexpr stack_vector<T, dim> active() const {
         return active_;
     }
 
     void clear() {
-        active_ = stack_vector<T, base_dim>::from(weights_->b);
+        active_ = stack_vector<T, dim>::from(weights_->b);
     }
 
     void insert(const size_t idx) {
@@ -65,22 +202,48 @@ struct feature_transformer {
         weights_->erase_idx(idx, active_);
     }
 
-    feature_transformer(const big_affine<T, half_ka_numel, base_dim>* src) : weights_{src} {
+    // Derive the active features from those of parent in a single pass over the accumulator
+    void update(const feature_transformer<T, Arch, Row>& parent, const feature_delta& delta) {
+        apply(parent.active_.data, delta);
+    }
+
+    // Rebuild the active features from the bias in a single pass over the accumulator
+    void refresh(const feature_delta& delta) {
+        apply(weights_->b, delta);
+    }
+
+    feature_transformer(const big_affine<T, half_ka_numel, dim, Row>* src) : weights_{src} {
         clear();
     }
+
+   private:
+    void apply(const T* src, const feature_delta& delta) {
+        const Row* added[feature_delta::capacity];
+        const Row* removed[feature_delta::capacity];
+        for (size_t i = 0; i < delta.num_added; ++i) {
+            added[i] = weights_->row(delta.added[i]);
+        }
+        for (size_t i = 0; i < delta.num_removed; ++i) {
+            removed[i] = weights_->row(delta.removed[i]);
+        }
+        simd::update(active_.data, src, added, delta.num_added, removed, delta.num_removed, dim);
+    }
 };
 
-template <typename T>
+template <typename T, typename Arch = default_architecture, typename Row = T>
 struct eval {
-    const weights<T>* weights_;
-    feature_transformer<T> white;
-    feature_transformer<T> black;
+    using weights_type = weights<T, Arch, Row>;
+
+    const weights_type* weights_;
+    feature_transformer<T, Arch, Row> white;
+    feature_transformer<T, Arch, Row> black;
 
     constexpr T propagate(const bool pov) const {
         const auto w_x = white.active();
         const auto b_x = black.active();
-        const auto x0 = pov ? splice(w_x, b_x).apply_(relu<T>) : splice(b_x, w_x).apply_(relu<T>);
-        const auto x1 = (weights_->fc0).forward(x0).apply_(relu<T>);
+        // fc0 only reads the positive entries, so the relu on x0 comes for free
+        const auto x0 = pov ? splice(w_x, b_x) : splice(b_x, w_x);
+        const auto x1 = (weights_->fc0).relu_forward(x0).apply_(relu<T>);
         const auto x2 = splice(x1, (weights_->fc1).forward(x1).apply_(relu<T>));
         const T val = (weights_->fc2).forward(x2).item();
         return val;
@@ -91,7 +254,57 @@ struct eval {
         return static_cast<int>(value);
     }
 
-    eval(const weights<T>* src) : weights_{src}, white{&(src->w)}, black{&(src->b)} {
+    // evaluate(povs[k]) of evaluators[k] for n evaluators sharing a network. The dense layers run across the
+    // batch so each weight is loaded once per simd::batch_tile positions. Results match evaluate().
+    static void evaluate_batch(const eval<T, Arch, Row>* evaluators, const bool* povs, int* out, const size_t n) {
+        constexpr size_t base = Arch::base_dim;
+        constexpr size_t x0_dim = 2 * base;
+        constexpr size_t x1_dim = Arch::fc0_dim;
+        constexpr size_t h_dim = Arch::fc1_dim;
+        constexpr size_t x2_dim = Arch::fc2_in;
+        alignas(cache_line) T x0[eval_batch_size * x0_dim];
+        alignas(cache_line) T x1[eval_batch_size * x1_dim];
+        alignas(cache_line) T h[eval_batch_size * h_dim];
+        alignas(cache_line) T x2[eval_batch_size * x2_dim];
+        alignas(cache_line) T y[eval_batch_size];
+
+        for (size_t start = 0; start < n; start += eval_batch_size) {
+            const size_t m = std::min(eval_batch_size, n - start);
+            const weights_type& w = *evaluators[start].weights_;
+
+            for (size_t k = 0; k < m; ++k) {
+                const auto& e = evaluators[start + k];
+                const auto& us = povs[start + k] ? e.white : e.black;
+                const auto& them = povs[start + k] ? e.black : e.white;
+                for (size_t i = 0; i < base; ++i) {
+                    x0[k * x0_dim + i] = relu<T>(us.active_.data[i]);
+                    x0[k * x0_dim + base + i] = relu<T>(them.active_.data[i]);
+                }
+            }
+
+            w.fc0.forward_batch(x0, x1, m);
+            for (size_t i = 0; i < m * x1_dim; ++i) {
+                x1[i] = relu<T>(x1[i]);
+            }
+            w.fc1.forward_batch(x1, h, m);
+            for (size_t k = 0; k < m; ++k) {
+                for (size_t i = 0; i < x1_dim; ++i) {
+                    x2[k * x2_dim + i] = x1[k * x1_dim + i];
+                }
+                for (size_t i = 0; i < h_dim; ++i) {
+                    x2[k * x2_dim + x1_dim + i] = relu<T>(h[k * h_dim + i]);
+                }
+            }
+            w.fc2.forward_batch(x2, y, m);
+
+            for (size_t k = 0; k < m; ++k) {
+                const T value = 600.0 * y[k];
+                out[start + k] = static_cast<int>(value);
+            }
+        }
+    }
+
+    eval(const weights_type* src) : weights_{src}, white{&(src->w)}, black{&(src->b)} {
     }
 };
 
@@ -0,0 +1,422 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include "nnue_model.hpp"
+#include "nnue_util.hpp"
+#include "weights_streamer.hpp"
+
+namespace nnue {
+
+using quantized_ft_type = std::int16_t;
+using quantized_weight_type = std::int8_t;
+using quantized_acc_type = std::int32_t;
+
+constexpr float quantized_ft_max = static_cast<float>(std::numeric_limits<quantized_ft_type>::max());
+constexpr float quantized_weight_max = static_cast<float>(std::numeric_limits<quantized_weight_type>::max());
+
+template <typename T, typename F>
+T saturate(const F& x) {
+    const F lo = static_cast<F>(std::numeric_limits<T>::min());
+    const F hi = static_cast<F>(std::numeric_limits<T>::max());
+    return static_cast<T>(std::clamp(x, lo, hi));
+}
+
+template <typename T>
+T quantize(const float x, const float scale) {
+    return saturate<T>(std::round(x * scale));
+}
+
+inline float max_abs(const float* data, const size_t numel) {
+    float result{0};
+    for (size_t i = 0; i < numel; ++i) {
+        result = std::max(result, std::abs(data[i]));
+    }
+    return result;
+}
+
+// apply relu to n int32 accumulators and rescale them back into the int16 activation domain
+inline void relu_shift(const quantized_acc_type* x, quantized_ft_type* out, const size_t n, const int shift) {
+    constexpr quantized_acc_type hi = std::numeric_limits<quantized_ft_type>::max();
+    const quantized_acc_type round = shift > 0 ? (quantized_acc_type{1} << (shift - 1)) : 0;
+#pragma omp simd
+    for (size_t i = 0; i < n; ++i) {
+        const quantized_acc_type shifted = (x[i] + round) >> shift;
+        out[i] = static_cast<quantized_ft_type>(std::clamp(shifted, quantized_acc_type{0}, hi));
+    }
+}
+
+template <size_t dim>
+constexpr stack_vector<quantized_ft_type, dim> relu_shift(const stack_vector<quantized_acc_type, dim>& x,
+                                                          const int shift) {
+    stack_vector<quantized_ft_type, dim> result{};
+    relu_shift(x.data, result.data, dim, shift);
+    return result;
+}
+
+template <size_t dim0, size_t dim1>
+struct quantized_affine {
+    static_assert(dim0 % 2 == 0, "inputs are taken in pairs");
+
+    static constexpr size_t W_numel = dim0 * dim1;
+    static constexpr size_t b_numel = dim1;
+
+    // Single outputs keep int8 weights for the dot product kernel, wider layers keep them widened to int16 for
+    // the madd of simd::affine_pairs. Only one copy is kept, the file's int8 order is rebuilt when saving.
+    using weight_type = std::conditional_t<dim1 == 1, quantized_weight_type, quantized_ft_type>;
+
+    // In pair order: the two weights of an output for inputs 2 * p and 2 * p + 1 sit next to each other.
+    // With a single output this is the file order.
+    alignas(cache_line) weight_type W[W_numel];
+    alignas(cache_line) quantized_acc_type b[b_numel];
+
+    // Position in W of the weight connecting input i to output j
+    static constexpr size_t index(const size_t i, const size_t j) {
+        return ((i / 2) * dim1 + j) * 2 + i % 2;
+    }
+
+    constexpr size_t num_parameters() const {
+        return W_numel + b_numel;
+    }
+
+    quantized_affine<dim0, dim1>& load_(weights_streamer& ws) {
+        quantized_weight_type file[W_numel];
+        ws.stream(file, W_numel).stream(b, b_numel);
+        for (size_t i = 0; i < dim0; ++i) {
+            for (size_t j = 0; j < dim1; ++j) {
+                W[index(i, j)] = file[i * dim1 + j];
+            }
+        }
+        return *this;
+    }
+
+    void save_(weights_writer& ww) const {
+        quantized_weight_type file[W_numel];
+        for (size_t i = 0; i < dim0; ++i) {
+            for (size_t j = 0; j < dim1; ++j) {
+                file[i * dim1 + j] = static_cast<quantized_weight_type>(W[index(i, j)]);
+            }
+        }
+        ww.write(file, W_numel).write(b, b_numel);
+    }
+
+    // A single output is a dot product, which the file order kernel already does with madd
+    constexpr stack_vector<quantized_acc_type, dim1> forward(const stack_vector<quantized_ft_type, dim0>& x) const {
+        stack_vector<quantized_acc_type, dim1> result;
+        if constexpr (dim1 == 1) {
+            simd::affine(x.data, W, b, result.data, dim0, dim1);
+        } else {
+            simd::affine_pairs(x.data, W, b, result.data, dim0, dim1);
+        }
+        return result;
+    }
+
+    // See stack_affine::relu_forward. With two inputs per madd, skipping zero inputs would only skip pairs
+    // that are zero as a whole, too few to pay for finding them, so this is dense.
+    constexpr stack_vector<quantized_acc_type, dim1> relu_forward(
+        const stack_vector<quantized_ft_type, dim0>& x) const {
+        return forward(x.apply(relu<quantized_ft_type>));
+    }
+
+    void forward_batch(const quantized_ft_type* x, quantized_acc_type* out, const size_t batch) const {
+        if constexpr (dim1 == 1) {
+            simd::affine_batch(x, W, b, out, batch, dim0, dim1);
+        } else {
+            for (size_t r = 0; r < batch; ++r) {
+                simd::affine_pairs(x + r * dim0, W, b, out + r * dim1, dim0, dim1);
+            }
+        }
+    }
+
+    // quantized outputs are on output_scale, so input i needs its weights scaled by output_scale / input_scale[i]
+    quantized_affine<dim0, dim1>& quantize_(const stack_affine<float, dim0, dim1>& src,
+                                            const stack_vector<float, dim0>& input_scale,
+                                            const float output_scale) {
+        for (size_t i = 0; i < dim0; ++i) {
+            const float scale = output_scale / input_scale.data[i];
+            for (size_t j = 0; j < dim1; ++j) {
+                W[index(i, j)] = quantize<quantized_weight_type>(src.W[i * dim1 + j], scale);
+            }
+        }
+        for (size_t i = 0; i < b_numel; ++i) {
+            b[i] = quantize<quantized_acc_type>(src.b[i], output_scale);
+        }
+        return *this;
+    }
+};
+
+// largest output scale for which every weight of the layer still fits in the int8 range
+template <size_t dim0, size_t dim1>
+float max_output_scale(const stack_affine<float, dim0, dim1>& src, const stack_vector<float, dim0>& input_scale) {
+    float ratio{0};
+    for (size_t i = 0; i < dim0; ++i) {
+        for (size_t j = 0; j < dim1; ++j) {
+            ratio = std::max(ratio, std::abs(src.W[i * dim1 + j]) / input_scale.data[i]);
+        }
+    }
+    return ratio > 0.0f ? quantized_weight_max / ratio : 1.0f;
+}
+
+template <size_t dim>
+constexpr stack_vector<float, dim> constant(const float x) {
+    return stack_vector<float, dim>::ones().apply_([x](const float y) { return x * y; });
+}
+
+// number of right shifts taking an accumulator on acc_scale to the largest activation scale not above target
+inline int activation_shift(const float acc_scale, const float target) {
+    if (!(acc_scale > target)) {
+        return 0;
+    }
+    return static_cast<int>(std::ceil(std::log2(acc_scale / target)));
+}
+
+template <size_t dim0, size_t dim1>
+void quantize_big_affine(big_affine<quantized_ft_type, dim0, dim1>& dst,
+                         const big_affine<float, dim0, dim1>& src,
+                         const float scale) {
+    for (size_t i = 0; i < dim0 * dim1; ++i) {
+        dst.W[i] = quantize<quantized_ft_type>(src.W[i], scale);
+    }
+    for (size_t i = 0; i < dim1; ++i) {
+        dst.b[i] = quantize<quantized_ft_type>(src.b[i], scale);
+    }
+    dst.derive_flips_();
+}
+
+// worst case magnitude of any accumulator entry: every square holds either a "us" or a "them" stone, never both
+template <size_t dim0, size_t dim1>
+float accumulator_bound(const big_affine<float, dim0, dim1>& src) {
+    static_assert(dim0 % 2 == 0, "expected a half-ka feature layout");
+    constexpr size_t squares = dim0 / 2;
+    float result{0};
+    for (size_t j = 0; j < dim1; ++j) {
+        float bound = std::abs(src.b[j]);
+        for (size_t sq = 0; sq < squares; ++sq) {
+            bound += std::max(std::abs(src.W[sq * dim1 + j]), std::abs(src.W[(squares + sq) * dim1 + j]));
+        }
+        result = std::max(result, bound);
+    }
+    return result;
+}
+
+// worst case magnitude of the outputs of an affine layer given a bound on the magnitude of its inputs
+template <size_t dim0, size_t dim1>
+float affine_bound(const stack_affine<float, dim0, dim1>& src, const float input_bound) {
+    float result{0};
+    for (size_t j = 0; j < dim1; ++j) {
+        float bound = std::abs(src.b[j]);
+        for (size_t i = 0; i < dim0; ++i) {
+            bound += std::abs(src.W[i * dim1 + j]) * input_bound;
+        }
+        result = std::max(result, bound);
+    }
+    return result;
+}
+
+// int16 feature transformer, int8 dense layers with int32 accumulation.
+// All scales are derived from the float network at load time from worst case activation bounds, so no
+// intermediate value can overflow its integer type.
+template <typename Arch>
+struct basic_quantized_weights {
+    using architecture_type = Arch;
+    using float_type = weights<float, Arch>;
+
+    big_affine<quantized_ft_type, half_ka_numel, Arch::base_dim> w{};
+    big_affine<quantized_ft_type, half_ka_numel, Arch::base_dim> b{};
+    quantized_affine<2 * Arch::base_dim, Arch::fc0_dim> fc0{};
+    quantized_affine<Arch::fc0_dim, Arch::fc1_dim> fc1{};
+    quantized_affine<Arch::fc2_in, 1> fc2{};
+
+    int fc0_shift{0};
+    int fc1_shift{0};
+    float output_scale{1.0f};
+
+    std::uint64_t hash_{0};
+
+    size_t num_parameters() const {
+        return w.num_parameters() + b.num_parameters() + fc0.num_parameters() + fc1.num_parameters() +
+               fc2.num_parameters();
+    }
+
+    size_t payload_bytes() const {
+        return sizeof(quantized_ft_type) * (w.num_parameters() + b.num_parameters()) +
+               sizeof(quantized_weight_type) * (fc0.W_numel + fc1.W_numel + fc2.W_numel) +
+               sizeof(quantized_acc_type) * (fc0.b_numel + fc1.b_numel + fc2.b_numel);
+    }
+
+    size_t signature() const {
+        return hash_;
+    }
+
+    basic_quantized_weights<Arch>& load(const std::string& path) {
+        return load(weights_streamer(path));
+    }
+
+    basic_quantized_weights<Arch>& load(weights_streamer&& ws) {
+        const auto header = ws.open(element_type::quantized, Arch::dims, payload_bytes(), 0);
+        w.load_(ws);
+        b.load_(ws);
+        fc0.load_(ws);
+        fc1.load_(ws);
+        fc2.load_(ws);
+        fc0_shift = header.fc0_shift;
+        fc1_shift = header.fc1_shift;
+        output_scale = header.output_scale;
+        hash_ = header.payload_hash;
+        return *this;
+    }
+
+    // See weights::share_
+    void share_(weights_writer& ww) const {
+        w.share_(ww);
+        b.share_(ww);
+        fc0.save_(ww);
+        fc1.save_(ww);
+        fc2.save_(ww);
+        ww.write(&fc0_shift, 1).write(&fc1_shift, 1).write(&output_scale, 1).write(&hash_, 1);
+    }
+
+    basic_quantized_weights<Arch>& attach(weights_streamer&& ws) {
+        w.attach_(ws);
+        b.attach_(ws);
+        fc0.load_(ws);
+        fc1.load_(ws);
+        fc2.load_(ws);
+        ws.stream(&fc0_shift, 1).stream(&fc1_shift, 1).stream(&output_scale, 1).stream(&hash_, 1);
+        return *this;
+    }
+
+    void save(const std::string& path) const {
+        weights_writer ww;
+        w.save_(ww);
+        b.save_(ww);
+        fc0.save_(ww);
+        fc1.save_(ww);
+        fc2.save_(ww);
+
+        file_header header{};
+        header.element = element_type::quantized;
+        header.dims = Arch::dims;
+        header.fc0_shift = fc0_shift;
+        header.fc1_shift = fc1_shift;
+        header.output_scale = output_scale;
+        ww.save(path, header);
+    }
+
+    basic_quantized_weights<Arch>& quantize(const float_type& src) {
+        // Feature transformer: use as much of the int16 range as the worst case accumulator allows, less room for
+        // the rounding of the bias and of each square's row, up to half a unit each
+        constexpr float ft_rounding = (half_ka_numel / 2 + 1) / 2.0f;
+        const float ft_bound = std::max(accumulator_bound(src.w), accumulator_bound(src.b));
+        const float ft_scale = ft_bound > 0.0f ? (quantized_ft_max - ft_rounding) / ft_bound : 1.0f;
+        quantize_big_affine(w, src.w, ft_scale);
+        quantize_big_affine(b, src.b, ft_scale);
+
+        // Hidden activations get their own scales, chosen from worst case bounds and realised by a right shift
+        const float x1_bound = affine_bound(src.fc0, ft_bound);
+        const auto ft_scales = constant<2 * Arch::base_dim>(ft_scale);
+        const float fc0_scale = max_output_scale(src.fc0, ft_scales);
+        fc0.quantize_(src.fc0, ft_scales, fc0_scale);
+        fc0_shift = activation_shift(fc0_scale, quantized_ft_max / x1_bound);
+        const float x1_scale = fc0_scale / static_cast<float>(1 << fc0_shift);
+
+        const float x2_bound = affine_bound(src.fc1, x1_bound);
+        const auto x1_scales = constant<Arch::fc0_dim>(x1_scale);
+        const float fc1_scale = max_output_scale(src.fc1, x1_scales);
+        fc1.quantize_(src.fc1, x1_scales, fc1_scale);
+        fc1_shift = activation_shift(fc1_scale, quantized_ft_max / x2_bound);
+        const float x2_scale = fc1_scale / static_cast<float>(1 << fc1_shift);
+
+        // fc2 sees x1 and relu(fc1(x1)) spliced together, each on its own scale
+        const auto fc2_input_scale = splice(x1_scales, constant<Arch::fc1_dim>(x2_scale));
+        const float fc2_scale = max_output_scale(src.fc2, fc2_input_scale);
+        fc2.quantize_(src.fc2, fc2_input_scale, fc2_scale);
+        output_scale = 1.0f / fc2_scale;
+        hash_ = src.signature();
+
+        return *this;
+    }
+};
+
+template <typename Arch>
+struct basic_quantized_eval {
+    using weights_type = basic_quantized_weights<Arch>;
+
+    const weights_type* weights_;
+    feature_transformer<quantized_ft_type, Arch> white;
+    feature_transformer<quantized_ft_type, Arch> black;
+
+    constexpr float propagate(const bool pov) const {
+        const auto w_x = white.active();
+        const auto b_x = black.active();
+        // fc0 applies the relu on x0 itself and stays dense, see quantized_affine::relu_forward
+        const auto x0 = pov ? splice(w_x, b_x) : splice(b_x, w_x);
+        const auto x1 = relu_shift((weights_->fc0).relu_forward(x0), weights_->fc0_shift);
+        const auto x2 = splice(x1, relu_shift((weights_->fc1).forward(x1), weights_->fc1_shift));
+        const quantized_acc_type val = (weights_->fc2).forward(x2).item();
+        return static_cast<float>(val) * weights_->output_scale;
+    }
+
+    constexpr int evaluate(const bool pov) const {
+        const float value = 600.0f * propagate(pov);
+        return static_cast<int>(value);
+    }
+
+    // See eval<T>::evaluate_batch
+    static void evaluate_batch(const basic_quantized_eval<Arch>* evaluators,
+                               const bool* povs,
+                               int* out,
+                               const size_t n) {
+        constexpr size_t base = Arch::base_dim;
+        constexpr size_t x0_dim = 2 * base;
+        constexpr size_t x1_dim = Arch::fc0_dim;
+        constexpr size_t h_dim = std::max(Arch::fc0_dim, Arch::fc1_dim);
+        constexpr size_t x2_dim = Arch::fc2_in;
+        alignas(cache_line) quantized_ft_type x0[eval_batch_size * x0_dim];
+        alignas(cache_line) quantized_acc_type h[eval_batch_size * h_dim];
+        alignas(cache_line) quantized_ft_type x1[eval_batch_size * x1_dim];
+        alignas(cache_line) quantized_ft_type x2[eval_batch_size * x2_dim];
+        alignas(cache_line) quantized_acc_type y[eval_batch_size];
+
+        for (size_t start = 0; start < n; start += eval_batch_size) {
+            const size_t m = std::min(eval_batch_size, n - start);
+            const weights_type& w = *evaluators[start].weights_;
+
+            for (size_t k = 0; k < m; ++k) {
+                const auto& e = evaluators[start + k];
+                const auto& us = povs[start + k] ? e.white : e.black;
+                const auto& them = povs[start + k] ? e.black : e.white;
+                for (size_t i = 0; i < base; ++i) {
+                    x0[k * x0_dim + i] = relu<quantized_ft_type>(us.active_.data[i]);
+                    x0[k * x0_dim + base + i] = relu<quantized_ft_type>(them.active_.data[i]);
+                }
+            }
+
+            w.fc0.forward_batch(x0, h, m);
+            relu_shift(h, x1, m * x1_dim, w.fc0_shift);
+            w.fc1.forward_batch(x1, h, m);
+            for (size_t k = 0; k < m; ++k) {
+                std::copy(x1 + k * x1_dim, x1 + (k + 1) * x1_dim, x2 + k * x2_dim);
+                relu_shift(h + k * Arch::fc1_dim, x2 + k * x2_dim + x1_dim, Arch::fc1_dim, w.fc1_shift);
+            }
+            w.fc2.forward_batch(x2, y, m);
+
+            for (size_t k = 0; k < m; ++k) {
+                const float value = 600.0f * (static_cast<float>(y[k]) * w.output_scale);
+                out[start + k] = static_cast<int>(value);
+            }
+        }
+    }
+
+    basic_quantized_eval(const weights_type* src) : weights_{src}, white{&(src->w)}, black{&(src->b)} {
+    }
+};
+
+using quantized_weights = basic_quantized_weights<default_architecture>;
+using quantized_eval = basic_quantized_eval<default_architecture>;
+
+}  // namespace nnue
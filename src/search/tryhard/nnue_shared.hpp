@@ -0,0 +1,234 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include "nnue_format.hpp"
+#include "weights_streamer.hpp"
+
+namespace nnue {
+
+// Networks shared between the processes of a user on a host through POSIX shared memory. The first process to
+// load a network writes it, as laid out in memory with flip rows and quantized weights, into a read-only object
+// named after the user and the network. Later processes attach to that object instead of loading the file, so all
+// of them read the same physical pages. Objects are private to their owner: other users can neither read them
+// nor get theirs attached to.
+//
+// Every process holds a shared flock on an object for as long as it has it mapped, its writer an exclusive one
+// until it is complete. Whoever gets the exclusive lock without waiting therefore knows that nobody else uses
+// the object: the last process to let go of it removes it, and the next process to load a network whose object
+// was left unfinished replaces it. The kernel drops the locks of processes that die, so an object they leave
+// behind is removed by the next process attached to it.
+
+constexpr char shared_magic[8] = {'A', 'T', 'X', 'S', 'H', 'M', '\0', '\0'};
+// Changes with the layout written by share_(), of the header, or the locking, so objects of other builds are
+// never attached to
+constexpr std::uint32_t shared_version = 3;
+// Size of a transparent huge page on x86-64
+constexpr size_t shared_huge_page = 2 * 1024 * 1024;
+
+// In front of the payload, keeping it on a cache line
+struct shared_header {
+    char magic[8];
+    std::uint32_t version;
+    // Set last by the writer: an object without it is still being written, or its writer died
+    std::uint32_t ready;
+    std::uint64_t payload_bytes;
+    // xxh64 of the payload: the name is predictable, so whatever sits under it is checked before use
+    std::uint64_t payload_hash;
+    std::uint8_t reserved[32];
+};
+
+static_assert(sizeof(shared_header) == cache_line, "shared_header must keep the payload aligned");
+
+// Name of the shared object of a network for the current user, given the precision it is held in, its width and
+// signature
+inline std::string shared_name(const std::string& precision, const size_t base_dim, const std::uint64_t signature) {
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), "%016llx", static_cast<unsigned long long>(signature));
+    return "/autaxx-nnue-v" + std::to_string(shared_version) + "-u" + std::to_string(::geteuid()) + "-" +
+           precision + "-" + std::to_string(base_dim) + "-" + suffix;
+}
+
+namespace detail {
+
+// Whether an object with these attributes can only have been written by the current user. The name alone
+// doesn't tell, anyone can create an object under it first.
+inline bool owned(const struct stat& st) {
+    return st.st_uid == ::geteuid() && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// Whether name still refers to the object open as fd, and not to one that replaced it
+inline bool named(const int fd, const std::string& name) {
+    const int other = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (other < 0) {
+        return false;
+    }
+    struct stat a {};
+    struct stat b {};
+    const bool same =
+        ::fstat(fd, &a) == 0 && ::fstat(other, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+    ::close(other);
+    return same;
+}
+
+// Whether the object of size bytes mapped at addr is completely written, and its payload hashes to what its
+// writer recorded
+inline bool complete(const void* addr, const size_t size) {
+    const auto* header = static_cast<const shared_header*>(addr);
+    const bool ready = __atomic_load_n(&header->ready, __ATOMIC_ACQUIRE) != 0;
+    return ready && std::memcmp(header->magic, shared_magic, sizeof(shared_magic)) == 0 &&
+           header->version == shared_version && header->payload_bytes == size - sizeof(shared_header) &&
+           xxh64::hash(static_cast<const char*>(addr) + sizeof(shared_header), header->payload_bytes) ==
+               header->payload_hash;
+}
+
+// Let go of the object name open as fd, removing it if no other process is attached to it
+inline void detach(const int fd, const std::string& name) {
+    if (::flock(fd, LOCK_EX | LOCK_NB) == 0 && named(fd, name)) {
+        ::shm_unlink(name.c_str());
+    }
+    ::close(fd);
+}
+
+// The payload of the object name of size bytes mapped at addr, which keeps fd and its lock until it is unmapped
+inline weights_mapping shared_payload(void* addr, const size_t size, const int fd, const std::string& name) {
+    const std::shared_ptr<const char> owner(static_cast<const char*>(addr), [size, fd, name](const char* p) {
+        ::munmap(const_cast<char*>(p), size);
+        detach(fd, name);
+    });
+    return weights_mapping(std::shared_ptr<const char>(owner, owner.get() + sizeof(shared_header)),
+                           size - sizeof(shared_header),
+                           true);
+}
+
+}  // namespace detail
+
+// The payload of the shared object name, or an empty mapping unless it exists, belongs to the current user, is
+// completely written, and its payload hashes to what its writer recorded. Waits for a writer to finish.
+inline weights_mapping attach_shared(const std::string& name) {
+    const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return {};
+    }
+
+    // The size is only final once the writer lets go of its lock
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || !detail::owned(st) || ::flock(fd, LOCK_SH) != 0 || ::fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(shared_header)) {
+        ::close(fd);
+        return {};
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void* addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        ::close(fd);
+        return {};
+    }
+    if (!detail::complete(addr, size)) {
+        ::munmap(addr, size);
+        detail::detach(fd, name);
+        return {};
+    }
+    return detail::shared_payload(addr, size, fd, name);
+}
+
+namespace detail {
+
+// Remove the existing object name of the current user if it will never be attached to: no process uses it, and
+// it is unfinished or refused by attach_shared. Deciding that under the exclusive lock keeps other processes
+// from attaching to or replacing the object meanwhile. Objects of other users are left alone.
+inline bool remove_abandoned(const std::string& name) {
+    const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st {};
+    bool abandoned = ::fstat(fd, &st) == 0 && owned(st) && ::flock(fd, LOCK_EX | LOCK_NB) == 0;
+    const size_t size = static_cast<size_t>(st.st_size);
+    if (abandoned && size >= sizeof(shared_header)) {
+        void* addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        abandoned = addr != MAP_FAILED && !complete(addr, size);
+        if (addr != MAP_FAILED) {
+            ::munmap(addr, size);
+        }
+    }
+    const bool removed = abandoned && named(fd, name) && ::shm_unlink(name.c_str()) == 0;
+    ::close(fd);
+    return removed;
+}
+
+}  // namespace detail
+
+// Create the shared object name holding what write(weights_writer&) writes, and return its payload.
+// Returns an empty mapping if shared memory can't be used or another process got to create it first. An
+// abandoned object under the name is replaced.
+template <typename F>
+weights_mapping create_shared(const std::string& name, F&& write) {
+    weights_writer ww;
+    write(ww);
+    const size_t size = sizeof(shared_header) + ww.payload_.size();
+
+    int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 && errno == EEXIST && detail::remove_abandoned(name)) {
+        fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        return {};
+    }
+    const auto discard = [&] {
+        if (detail::named(fd, name)) {
+            ::shm_unlink(name.c_str());
+        }
+        ::close(fd);
+        return weights_mapping{};
+    };
+    // Until it is complete, so that nobody takes the object for abandoned. Another process may have found it
+    // empty and replaced it just before, in which case this one is only private to this process.
+    if (::flock(fd, LOCK_EX) != 0) {
+        return discard();
+    }
+    // Reserve the pages up front, running out of them later would be a SIGBUS instead of an error
+    if (::posix_fallocate(fd, 0, static_cast<off_t>(size)) != 0) {
+        return discard();
+    }
+    void* addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        return discard();
+    }
+#ifdef MADV_HUGEPAGE
+    // Only networks spanning a whole huge page can be backed by one, and only if the host allows huge pages for
+    // shared memory
+    if (size >= shared_huge_page) {
+        ::madvise(addr, size, MADV_HUGEPAGE);
+    }
+#endif
+
+    auto* header = static_cast<shared_header*>(addr);
+    std::memcpy(header->magic, shared_magic, sizeof(shared_magic));
+    header->version = shared_version;
+    header->payload_bytes = ww.payload_.size();
+    header->payload_hash = xxh64::hash(ww.payload_.data(), ww.payload_.size());
+    std::memcpy(static_cast<char*>(addr) + sizeof(shared_header), ww.payload_.data(), ww.payload_.size());
+    __atomic_store_n(&header->ready, 1u, __ATOMIC_RELEASE);
+    ::mprotect(addr, size, PROT_READ);
+    // From here on attached like any other process
+    ::flock(fd, LOCK_SH);
+
+    return detail::shared_payload(addr, size, fd, name);
+}
+
+// Remove the shared object name. Processes attached to it keep their mapping.
+inline void remove_shared(const std::string& name) {
+    ::shm_unlink(name.c_str());
+}
+
+}  // namespace nnue
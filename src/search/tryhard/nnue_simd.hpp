@@ -0,0 +1,1898 @@
+#pragma once
+
+#include <immintrin.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "nnue_half.hpp"
+
+namespace nnue {
+
+namespace simd {
+
+enum class instruction_set : std::uint8_t
+{
+    scalar = 0,
+    sse41,
+    avx2,
+    avx512
+};
+
+// Every kernel handles arbitrary lengths; the vector paths fall back to scalar code for any tail.
+// Dense layers use the input major layout of stack_affine: W[i * dim1 + j] connects input i to output j.
+struct kernels {
+    instruction_set isa;
+    void (*add_f32)(float* dst, const float* src, size_t n);
+    void (*sub_f32)(float* dst, const float* src, size_t n);
+    void (*add_i16)(std::int16_t* dst, const std::int16_t* src, size_t n);
+    void (*sub_i16)(std::int16_t* dst, const std::int16_t* src, size_t n);
+    // The update kernels read only the first num_added and num_removed rows, as their access attributes say, so
+    // callers may pass arrays filled no further
+    void (*update_f32)(float* dst,
+                       const float* src,
+                       const float* const* added,
+                       size_t num_added,
+                       const float* const* removed,
+                       size_t num_removed,
+                       size_t n)
+        [[gnu::access(read_only, 3, 4), gnu::access(read_only, 5, 6)]];
+    void (*update_i16)(std::int16_t* dst,
+                       const std::int16_t* src,
+                       const std::int16_t* const* added,
+                       size_t num_added,
+                       const std::int16_t* const* removed,
+                       size_t num_removed,
+                       size_t n)
+        [[gnu::access(read_only, 3, 4), gnu::access(read_only, 5, 6)]];
+    void (*affine_f32)(const float* x, const float* W, const float* b, float* out, size_t dim0, size_t dim1);
+    void (*affine_i8)(const std::int16_t* x,
+                      const std::int8_t* W,
+                      const std::int32_t* b,
+                      std::int32_t* out,
+                      size_t dim0,
+                      size_t dim1);
+    // The dense layers over a batch: row r of x, dim0 wide, maps to row r of out, dim1 wide
+    void (*affine_batch_f32)(const float* x,
+                             const float* W,
+                             const float* b,
+                             float* out,
+                             size_t batch,
+                             size_t dim0,
+                             size_t dim1);
+    void (*affine_batch_i8)(const std::int16_t* x,
+                            const std::int8_t* W,
+                            const std::int32_t* b,
+                            std::int32_t* out,
+                            size_t batch,
+                            size_t dim0,
+                            size_t dim1);
+    // Positions of the positive entries of x in increasing order, returning how many there are.
+    // indices needs room for n + nonzero_slack entries, as vector paths store whole blocks.
+    size_t (*nonzero_f32)(const float* x, size_t n, std::uint32_t* indices);
+    size_t (*nonzero_i16)(const std::int16_t* x, size_t n, std::uint32_t* indices);
+    // The dense layer with only the listed inputs of x, all others being zero: weight rows of zero inputs
+    // are never read. With more than one output this sums in the same order as the dense kernel.
+    void (*affine_sparse_f32)(const float* x,
+                              const std::uint32_t* indices,
+                              size_t num_indices,
+                              const float* W,
+                              const float* b,
+                              float* out,
+                              size_t dim1);
+    void (*affine_sparse_i8)(const std::int16_t* x,
+                             const std::uint32_t* indices,
+                             size_t num_indices,
+                             const std::int8_t* W,
+                             const std::int32_t* b,
+                             std::int32_t* out,
+                             size_t dim1);
+    // The dense int8 layer with its weights in the pair layout of quantized_affine, widened to int16:
+    // P[(p * dim1 + j) * 2 + k] connects input 2 * p + k to output j, so one madd covers both inputs.
+    // dim0 must be even.
+    void (*affine_pairs_i16)(const std::int16_t* x,
+                             const std::int16_t* P,
+                             const std::int32_t* b,
+                             std::int32_t* out,
+                             size_t dim0,
+                             size_t dim1);
+    // update_f32 with the rows in 16 bit storage, widened to float as they are read
+    void (*update_bf16)(float* dst,
+                        const float* src,
+                        const bf16* const* added,
+                        size_t num_added,
+                        const bf16* const* removed,
+                        size_t num_removed,
+                        size_t n)
+        [[gnu::access(read_only, 3, 4), gnu::access(read_only, 5, 6)]];
+    void (*update_fp16)(float* dst,
+                        const float* src,
+                        const fp16* const* added,
+                        size_t num_added,
+                        const fp16* const* removed,
+                        size_t num_removed,
+                        size_t n)
+        [[gnu::access(read_only, 3, 4), gnu::access(read_only, 5, 6)]];
+};
+
+// Rows of a batch processed together by the batched dense kernels, each weight load serving all of them
+constexpr size_t batch_tile = 4;
+
+// Extra entries the nonzero kernels may write past the last index found
+constexpr size_t nonzero_slack = 16;
+
+// Offsets of the set bits of every byte, so eight lanes are compressed with a single lookup
+struct nonzero_table {
+    std::uint8_t offsets[256][8];
+};
+
+constexpr nonzero_table make_nonzero_table() {
+    nonzero_table table{};
+    for (size_t mask = 0; mask < 256; ++mask) {
+        size_t count = 0;
+        for (std::uint8_t bit = 0; bit < 8; ++bit) {
+            if (mask & (size_t{1} << bit)) {
+                table.offsets[mask][count++] = bit;
+            }
+        }
+    }
+    return table;
+}
+
+inline constexpr nonzero_table nonzero_lookup = make_nonzero_table();
+
+// Inputs 2 * p and 2 * p + 1 as the two int16 halves of one int32, the operand madd pairs with weights
+inline std::int32_t load_pair(const std::int16_t* x, const size_t p) {
+    std::int32_t pair;
+    std::memcpy(&pair, x + 2 * p, sizeof(pair));
+    return pair;
+}
+
+namespace scalar {
+
+template <typename T>
+inline void add(T* dst, const T* src, const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+template <typename T>
+inline void sub(T* dst, const T* src, const size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] -= src[i];
+    }
+}
+
+// dst[i] = src[i] + sum of the added rows - sum of the removed rows, for i in [begin, n).
+// Rows may be stored narrower than the accumulator, see nnue_half.hpp.
+template <typename T, typename R>
+inline void update(T* dst,
+                   const T* src,
+                   const R* const* added,
+                   const size_t num_added,
+                   const R* const* removed,
+                   const size_t num_removed,
+                   const size_t begin,
+                   const size_t n) {
+    for (size_t i = begin; i < n; ++i) {
+        T acc = src[i];
+        for (size_t k = 0; k < num_added; ++k) {
+            acc += static_cast<T>(added[k][i]);
+        }
+        for (size_t k = 0; k < num_removed; ++k) {
+            acc -= static_cast<T>(removed[k][i]);
+        }
+        dst[i] = acc;
+    }
+}
+
+template <typename X, typename W, typename A>
+inline void affine(const X* x, const W* w, const A* b, A* out, const size_t dim0, const size_t dim1) {
+    for (size_t j = 0; j < dim1; ++j) {
+        out[j] = b[j];
+    }
+    for (size_t i = 0; i < dim0; ++i) {
+        const A x_i = static_cast<A>(x[i]);
+        for (size_t j = 0; j < dim1; ++j) {
+            out[j] += x_i * static_cast<A>(w[i * dim1 + j]);
+        }
+    }
+}
+
+inline void add_f32(float* dst, const float* src, const size_t n) {
+    add(dst, src, n);
+}
+
+inline void sub_f32(float* dst, const float* src, const size_t n) {
+    sub(dst, src, n);
+}
+
+inline void add_i16(std::int16_t* dst, const std::int16_t* src, const size_t n) {
+    add(dst, src, n);
+}
+
+inline void sub_i16(std::int16_t* dst, const std::int16_t* src, const size_t n) {
+    sub(dst, src, n);
+}
+
+inline void update_f32(float* dst,
+                       const float* src,
+                       const float* const* added,
+                       const size_t num_added,
+                       const float* const* removed,
+                       const size_t num_removed,
+                       const size_t n) {
+    update(dst, src, added, num_added, removed, num_removed, 0, n);
+}
+
+inline void update_i16(std::int16_t* dst,
+                       const std::int16_t* src,
+                       const std::int16_t* const* added,
+                       const size_t num_added,
+                       const std::int16_t* const* removed,
+                       const size_t num_removed,
+                       const size_t n) {
+    update(dst, src, added, num_added, removed, num_removed, 0, n);
+}
+
+inline void update_bf16(float* dst,
+                        const float* src,
+                        const bf16* const* added,
+                        const size_t num_added,
+                        const bf16* const* removed,
+                        const size_t num_removed,
+                        const size_t n) {
+    update(dst, src, added, num_added, removed, num_removed, 0, n);
+}
+
+inline void update_fp16(float* dst,
+                        const float* src,
+                        const fp16* const* added,
+                        const size_t num_added,
+                        const fp16* const* removed,
+                        const size_t num_removed,
+                        const size_t n) {
+    update(dst, src, added, num_added, removed, num_removed, 0, n);
+}
+
+inline void affine_f32(const float* x,
+                       const float* W,
+                       const float* b,
+                       float* out,
+                       const size_t dim0,
+                       const size_t dim1) {
+    affine(x, W, b, out, dim0, dim1);
+}
+
+inline void affine_i8(const std::int16_t* x,
+                      const std::int8_t* W,
+                      const std::int32_t* b,
+                      std::int32_t* out,
+                      const size_t dim0,
+                      const size_t dim1) {
+    affine(x, W, b, out, dim0, dim1);
+}
+
+// A batch as one single row affine per row, for shapes and instruction sets without a batched kernel
+template <typename X, typename W, typename A, void (*single)(const X*, const W*, const A*, A*, size_t, size_t)>
+inline void affine_rows(const X* x,
+                        const W* w,
+                        const A* b,
+                        A* out,
+                        const size_t batch,
+                        const size_t dim0,
+                        const size_t dim1) {
+    for (size_t r = 0; r < batch; ++r) {
+        single(x + r * dim0, w, b, out + r * dim1, dim0, dim1);
+    }
+}
+
+inline void affine_batch_f32(const float* x,
+                             const float* W,
+                             const float* b,
+                             float* out,
+                             const size_t batch,
+                             const size_t dim0,
+                             const size_t dim1) {
+    affine_rows<float, float, float, affine_f32>(x, W, b, out, batch, dim0, dim1);
+}
+
+inline void affine_batch_i8(const std::int16_t* x,
+                            const std::int8_t* W,
+                            const std::int32_t* b,
+                            std::int32_t* out,
+                            const size_t batch,
+                            const size_t dim0,
+                            const size_t dim1) {
+    affine_rows<std::int16_t, std::int8_t, std::int32_t, affine_i8>(x, W, b, out, batch, dim0, dim1);
+}
+
+template <typename T>
+inline size_t nonzero(const T* x, const size_t begin, const size_t n, std::uint32_t* indices) {
+    size_t count = 0;
+    for (size_t i = begin; i < n; ++i) {
+        if (x[i] > T{0}) {
+            indices[count++] = static_cast<std::uint32_t>(i);
+        }
+    }
+    return count;
+}
+
+// out[j] = b[j] + sum over the listed inputs, for j in [begin, dim1)
+template <typename X, typename W, typename A>
+inline void affine_sparse(const X* x,
+                          const std::uint32_t* indices,
+                          const size_t num_indices,
+                          const W* w,
+                          const A* b,
+                          A* out,
+                          const size_t begin,
+                          const size_t dim1) {
+    for (size_t j = begin; j < dim1; ++j) {
+        out[j] = b[j];
+    }
+    for (size_t k = 0; k < num_indices; ++k) {
+        const size_t i = indices[k];
+        const A x_i = static_cast<A>(x[i]);
+        for (size_t j = begin; j < dim1; ++j) {
+            out[j] += x_i * static_cast<A>(w[i * dim1 + j]);
+        }
+    }
+}
+
+inline size_t nonzero_f32(const float* x, const size_t n, std::uint32_t* indices) {
+    return nonzero(x, 0, n, indices);
+}
+
+inline size_t nonzero_i16(const std::int16_t* x, const size_t n, std::uint32_t* indices) {
+    return nonzero(x, 0, n, indices);
+}
+
+inline void affine_sparse_f32(const float* x,
+                              const std::uint32_t* indices,
+                              const size_t num_indices,
+                              const float* W,
+                              const float* b,
+                              float* out,
+                              const size_t dim1) {
+    affine_sparse(x, indices, num_indices, W, b, out, 0, dim1);
+}
+
+inline void affine_sparse_i8(const std::int16_t* x,
+                             const std::uint32_t* indices,
+                             const size_t num_indices,
+                             const std::int8_t* W,
+                             const std::int32_t* b,
+                             std::int32_t* out,
+                             const size_t dim1) {
+    affine_sparse(x, indices, num_indices, W, b, out, 0, dim1);
+}
+
+// out[j] = b[j] + sum over every pair of inputs, for j in [begin, dim1)
+inline void affine_pairs(const std::int16_t* x,
+                         const std::int16_t* P,
+                         const std::int32_t* b,
+                         std::int32_t* out,
+                         const size_t begin,
+                         const size_t dim0,
+                         const size_t dim1) {
+    for (size_t j = begin; j < dim1; ++j) {
+        out[j] = b[j];
+    }
+    for (size_t p = 0; p < dim0 / 2; ++p) {
+        const std::int32_t x0 = x[2 * p];
+        const std::int32_t x1 = x[2 * p + 1];
+        const std::int16_t* row = P + p * dim1 * 2;
+        for (size_t j = begin; j < dim1; ++j) {
+            out[j] += x0 * row[2 * j] + x1 * row[2 * j + 1];
+        }
+    }
+}
+
+inline void affine_pairs_i16(const std::int16_t* x,
+                             const std::int16_t* P,
+                             const std::int32_t* b,
+                             std::int32_t* out,
+                             const size_t dim0,
+                             const size_t dim1) {
+    affine_pairs(x, P, b, out, 0, dim0, dim1);
+}
+
+}  // namespace scalar
+
+namespace sse41 {
+
+[[gnu::target("sse4.1")]] inline void add_f32(float* dst, const float* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+    }
+    scalar::add(dst + i, src + i, n - i);
+}
+
+[[gnu::target("sse4.1")]] inline void sub_f32(float* dst, const float* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_sub_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+    }
+    scalar::sub(dst + i, src + i, n - i);
+}
+
+[[gnu::target("sse4.1")]] inline void add_i16(std::int16_t* dst, const std::int16_t* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi16(a, b));
+    }
+    scalar::add(dst + i, src + i, n - i);
+}
+
+[[gnu::target("sse4.1")]] inline void sub_i16(std::int16_t* dst, const std::int16_t* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_sub_epi16(a, b));
+    }
+    scalar::sub(dst + i, src + i, n - i);
+}
+
+[[gnu::target("sse4.1")]] inline void update_f32(float* dst,
+                                                 const float* src,
+                                                 const float* const* added,
+                                                 const size_t num_added,
+                                                 const float* const* removed,
+                                                 const size_t num_removed,
+                                                 const size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        auto acc = _mm_loadu_ps(src + i);
+        for (size_t k = 0; k < num_added; ++k) {
+            acc = _mm_add_ps(acc, _mm_loadu_ps(added[k] + i));
+        }
+        for (size_t k = 0; k < num_removed; ++k) {
+            acc = _mm_sub_ps(acc, _mm_loadu_ps(removed[k] + i));
+        }
+        _mm_storeu_ps(dst + i, acc);
+    }
+    scalar::update(dst, src, added, num_added, removed, num_removed, i, n);
+}
+
+[[gnu::target("sse4.1")]] inline void update_i16(std::int16_t* dst,
+                                                 const std::int16_t* src,
+                                                 const std::int16_t* const* added,
+                                                 const size_t num_added,
+                                                 const std::int16_t* const* removed,
+                                                 const size_t num_removed,
+                                                 const size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        auto acc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        for (size_t k = 0; k < num_added; ++k) {
+            acc = _mm_add_epi16(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(added[k] + i)));
+        }
+        for (size_t k = 0; k < num_removed; ++k) {
+            acc = _mm_sub_epi16(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(removed[k] + i)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), acc);
+    }
+    scalar::update(dst, src, added, num_added, removed, num_removed, i, n);
+}
+
+[[gnu::target("sse4.1")]] inline void affine_f32(const float* x,
+                                                const float* W,
+                                                const float* b,
+                                                float* out,
+                                                const size_t dim0,
+                                                const size_t dim1) {
+    size_t j = 0;
+    for (; j + 8 <= dim1; j += 8) {
+        auto acc0 = _mm_loadu_ps(b + j);
+        auto acc1 = _mm_loadu_ps(b + j + 4);
+        for (size_t i = 0; i < dim0; ++i) {
+            const auto x_i = _mm_set1_ps(x[i]);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(x_i, _mm_loadu_ps(W + i * dim1 + j)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(x_i, _mm_loadu_ps(W + i * dim1 + j + 4)));
+        }
+        _mm_storeu_ps(out + j, acc0);
+        _mm_storeu_ps(out + j + 4, acc1);
+    }
+    for (; j < dim1; ++j) {
+        float acc = b[j];
+        for (size_t i = 0; i < dim0; ++i) {
+            acc += x[i] * W[i * dim1 + j];
+        }
+        out[j] = acc;
+    }
+}
+
+[[gnu::target("sse4.1")]] inline void affine_i8(const std::int16_t* x,
+                                               const std::int8_t* W,
+                                               const std::int32_t* b,
+                                               std::int32_t* out,
+                                               const size_t dim0,
+                                               const size_t dim1) {
+    size_t j = 0;
+    for (; j + 8 <= dim1; j += 8) {
+        auto acc0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        auto acc1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j + 4));
+        for (size_t i = 0; i < dim0; ++i) {
+            const auto x_i = _mm_set1_epi32(x[i]);
+            const auto w = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(W + i * dim1 + j));
+            acc0 = _mm_add_epi32(acc0, _mm_mullo_epi32(x_i, _mm_cvtepi8_epi32(w)));
+            acc1 = _mm_add_epi32(acc1, _mm_mullo_epi32(x_i, _mm_cvtepi8_epi32(_mm_srli_si128(w, 4))));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), acc0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j + 4), acc1);
+    }
+    for (; j < dim1; ++j) {
+        std::int32_t acc = b[j];
+        for (size_t i = 0; i < dim0; ++i) {
+            acc += static_cast<std::int32_t>(x[i]) * W[i * dim1 + j];
+        }
+        out[j] = acc;
+    }
+}
+
+inline void affine_batch_f32(const float* x,
+                             const float* W,
+                             const float* b,
+                             float* out,
+                             const size_t batch,
+                             const size_t dim0,
+                             const size_t dim1) {
+    scalar::affine_rows<float, float, float, affine_f32>(x, W, b, out, batch, dim0, dim1);
+}
+
+inline void affine_batch_i8(const std::int16_t* x,
+                            const std::int8_t* W,
+                            const std::int32_t* b,
+                            std::int32_t* out,
+                            const size_t batch,
+                            const size_t dim0,
+                            const size_t dim1) {
+    scalar::affine_rows<std::int16_t, std::int8_t, std::int32_t, affine_i8>(x, W, b, out, batch, dim0, dim1);
+}
+
+// Eight lanes at a time: a comparison mask, then the offsets of its set bits from nonzero_lookup
+[[gnu::target("sse4.1")]] inline size_t nonzero_f32(const float* x, const size_t n, std::uint32_t* indices) {
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto lo = _mm_cmpgt_ps(_mm_loadu_ps(x + i), _mm_setzero_ps());
+        const auto hi = _mm_cmpgt_ps(_mm_loadu_ps(x + i + 4), _mm_setzero_ps());
+        const int mask = _mm_movemask_ps(lo) | (_mm_movemask_ps(hi) << 4);
+        const auto offsets = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(nonzero_lookup.offsets[mask]));
+        const auto base = _mm_set1_epi32(static_cast<int>(i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + count), _mm_add_epi32(base, _mm_cvtepu8_epi32(offsets)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + count + 4),
+                         _mm_add_epi32(base, _mm_cvtepu8_epi32(_mm_srli_si128(offsets, 4))));
+        count += __builtin_popcount(mask);
+    }
+    return count + scalar::nonzero(x, i, n, indices + count);
+}
+
+[[gnu::target("sse4.1")]] inline size_t nonzero_i16(const std::int16_t* x, const size_t n, std::uint32_t* indices) {
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        const auto positive = _mm_cmpgt_epi16(values, _mm_setzero_si128());
+        const int mask = _mm_movemask_epi8(_mm_packs_epi16(positive, _mm_setzero_si128()));
+        const auto offsets = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(nonzero_lookup.offsets[mask]));
+        const auto base = _mm_set1_epi32(static_cast<int>(i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + count), _mm_add_epi32(base, _mm_cvtepu8_epi32(offsets)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + count + 4),
+                         _mm_add_epi32(base, _mm_cvtepu8_epi32(_mm_srli_si128(offsets, 4))));
+        count += __builtin_popcount(mask);
+    }
+    return count + scalar::nonzero(x, i, n, indices + count);
+}
+
+[[gnu::target("sse4.1")]] inline void affine_sparse_f32(const float* x,
+                                                       const std::uint32_t* indices,
+                                                       const size_t num_indices,
+                                                       const float* W,
+                                                       const float* b,
+                                                       float* out,
+                                                       const size_t dim1) {
+    size_t j = 0;
+    for (; j + 8 <= dim1; j += 8) {
+        auto acc0 = _mm_loadu_ps(b + j);
+        auto acc1 = _mm_loadu_ps(b + j + 4);
+        for (size_t k = 0; k < num_indices; ++k) {
+            const size_t i = indices[k];
+            const auto x_i = _mm_set1_ps(x[i]);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(x_i, _mm_loadu_ps(W + i * dim1 + j)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(x_i, _mm_loadu_ps(W + i * dim1 + j + 4)));
+        }
+        _mm_storeu_ps(out + j, acc0);
+        _mm_storeu_ps(out + j + 4, acc1);
+    }
+    scalar::affine_sparse(x, indices, num_indices, W, b, out, j, dim1);
+}
+
+[[gnu::target("sse4.1")]] inline void affine_sparse_i8(const std::int16_t* x,
+                                                      const std::uint32_t* indices,
+                                                      const size_t num_indices,
+                                                      const std::int8_t* W,
+                                                      const std::int32_t* b,
+                                                      std::int32_t* out,
+                                                      const size_t dim1) {
+    size_t j = 0;
+    for (; j + 8 <= dim1; j += 8) {
+        auto acc0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        auto acc1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j + 4));
+        for (size_t k = 0; k < num_indices; ++k) {
+            const size_t i = indices[k];
+            const auto x_i = _mm_set1_epi32(x[i]);
+            const auto w = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(W + i * dim1 + j));
+            acc0 = _mm_add_epi32(acc0, _mm_mullo_epi32(x_i, _mm_cvtepi8_epi32(w)));
+            acc1 = _mm_add_epi32(acc1, _mm_mullo_epi32(x_i, _mm_cvtepi8_epi32(_mm_srli_si128(w, 4))));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), acc0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j + 4), acc1);
+    }
+    scalar::affine_sparse(x, indices, num_indices, W, b, out, j, dim1);
+}
+
+[[gnu::target("sse4.1")]] inline void affine_pairs_i16(const std::int16_t* x,
+                                                      const std::int16_t* P,
+                                                      const std::int32_t* b,
+                                                      std::int32_t* out,
+                                                      const size_t dim0,
+                                                      const size_t dim1) {
+    size_t j = 0;
+    for (; j + 8 <= dim1; j += 8) {
+        auto acc0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        auto acc1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j + 4));
+        for (size_t p = 0; p < dim0 / 2; ++p) {
+            const auto x_p = _mm_set1_epi32(load_pair(x, p));
+            const std::int16_t* row = P + (p * dim1 + j) * 2;
+            acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(x_p, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row))));
+            acc1 = _mm_add_epi32(acc1,
+                                 _mm_madd_epi16(x_p, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 8))));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), acc0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j + 4), acc1);
+    }
+    scalar::affine_pairs(x, P, b, out, j, dim0, dim1);
+}
+
+[[gnu::target("sse4.1")]] inline __m128 widen(const bf16* p) {
+    const auto h = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+    return _mm_castsi128_ps(_mm_slli_epi32(_mm_cvtepu16_epi32(h), 16));
+}
+
+[[gnu::target("sse4.1")]] inline void update_bf16(float* dst,
+                                                  const float* src,
+                                                  const bf16* const* added,
+                                                  const size_t num_added,
+                                                  const bf16* const* removed,
+                                                  const size_t num_removed,
+                                                  const size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        auto acc = _mm_loadu_ps(src + i);
+        for (size_t k = 0; k < num_added; ++k) {
+            acc = _mm_add_ps(acc, widen(added[k] + i));
+        }
+        for (size_t k = 0; k < num_removed; ++k) {
+            acc = _mm_sub_ps(acc, widen(removed[k] + i));
+        }
+        _mm_storeu_ps(dst + i, acc);
+    }
+    scalar::update(dst, src, added, num_added, removed, num_removed, i, n);
+}
+
+// Converting binary16 takes F16C, which CPUs without AVX2 may lack
+inline void update_fp16(float* dst,
+                        const float* src,
+                        const fp16* const* added,
+                        const size_t num_added,
+                        const fp16* const* removed,
+                        const size_t num_removed,
+                        const size_t n) {
+    scalar::update(dst, src, added, num_added, removed, num_removed, 0, n);
+}
+
+}  // namespace sse41
+
+namespace avx2 {
+
+[[gnu::target("avx2")]] inline float hsum(const __m256 x) {
+    const auto y = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+    const auto z = _mm_add_ps(y, _mm_movehl_ps(y, y));
+    return _mm_cvtss_f32(_mm_add_ss(z, _mm_movehdup_ps(z)));
+}
+
+[[gnu::target("avx2")]] inline std::int32_t hsum(const __m256i x) {
+    const auto y = _mm_add_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    const auto z = _mm_add_epi32(y, _mm_shuffle_epi32(y, 0b01001110));
+    return _mm_cvtsi128_si32(_mm_add_epi32(z, _mm_shuffle_epi32(z, 0b10110001)));
+}
+
+[[gnu::target("avx2")]] inline void add_f32(float* dst, const float* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+    }
+    scalar::add(dst + i, src + i, n - i);
+}
+
+[[gnu::target("avx2")]] inline void sub_f32(float* dst, const float* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_sub_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+    }
+    scalar::sub(dst + i, src + i, n - i);
+}
+
+[[gnu::target("avx2")]] inline void add_i16(std::int16_t* dst, const std::int16_t* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        const auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_add_epi16(a, b));
+    }
+    scalar::add(dst + i, src + i, n - i);
+}
+
+[[gnu::target("avx2")]] inline void sub_i16(std::int16_t* dst, const std::int16_t* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        const auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_sub_epi16(a, b));
+    }
+    scalar::sub(dst + i, src + i, n - i);
+}
+
+[[gnu::target("avx2")]] inline void update_f32(float* dst,
+                                               const float* src,
+                                               const float* const* added,
+                                               const size_t num_added,
+                                               const float* const* removed,
+                                               const size_t num_removed,
+                                               const size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        auto acc = _mm256_loadu_ps(src + i);
+        for (size_t k = 0; k < num_added; ++k) {
+            acc = _mm256_add_ps(acc, _mm256_loadu_ps(added[k] + i));
+        }
+        for (size_t k = 0; k < num_removed; ++k) {
+            acc = _mm256_sub_ps(acc, _mm256_loadu_ps(removed[k] + i));
+        }
+        _mm256_storeu_ps(dst + i, acc);
+    }
+    scalar::update(dst, src, added, num_added, removed, num_removed, i, n);
+}
+
+[[gnu::target("avx2")]] inline void update_i16(std::int16_t* dst,
+                                               const std::int16_t* src,
+                                               const std::int16_t* const* added,
+                                               const size_t num_added,
+                                               const std::int16_t* const* removed,
+                                               const size_t num_removed,
+                                               const size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        for (size_t k = 0; k < num_added; ++k) {
+            acc = _mm256_add_epi16(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(added[k] + i)));
+        }
+        for (size_t k = 0; k < num_removed; ++k) {
+            acc = _mm256_sub_epi16(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(removed[k] + i)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), acc);
+    }
+    scalar::update(dst, src, added, num_added, removed, num_removed, i, n);
+}
+
+[[gnu::target("avx2,fma")]] inline void affine_f32(const float* x,
+                                                  const float* W,
+                                                  const float* b,
+                                                  float* out,
+                                                  const size_t dim0,
+                                                  const size_t dim1) {
+    // A single output is a dot product over a contiguous column
+    if (dim1 == 1) {
+        auto acc = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= dim0; i += 8) {
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(W + i), acc);
+        }
+        float result = b[0] + hsum(acc);
+        for (; i < dim0; ++i) {
+            result += x[i] * W[i];
+        }
+        out[0] = result;
+        return;
+    }
+
+    size_t j = 0;
+    for (; j + 32 <= dim1; j += 32) {
+        auto acc0 = _mm256_loadu_ps(b + j);
+        auto acc1 = _mm256_loadu_ps(b + j + 8);
+        auto acc2 = _mm256_loadu_ps(b + j + 16);
+        auto acc3 = _mm256_loadu_ps(b + j + 24);
+        for (size_t i = 0; i < dim0; ++i) {
+            const auto x_i = _mm256_set1_ps(x[i]);
+            const float* row = W + i * dim1 + j;
+            acc0 = _mm256_fmadd_ps(x_i, _mm256_loadu_ps(row), acc0);
+            acc1 = _mm256_fmadd_ps(x_i, _mm256_loadu_ps(row + 8), acc1);
+            acc2 = _mm256_fmadd_ps(x_i, _mm256_loadu_ps(row + 16), acc2);
+            acc3 = _mm256_fmadd_ps(x_i, _mm256_loadu_ps(row + 24), acc3);
+        }
+        _mm256_storeu_ps(out + j, acc0);
+        _mm256_storeu_ps(out + j + 8, acc1);
+        _mm256_storeu_ps(out + j + 16, acc2);
+        _mm256_storeu_ps(out + j + 24, acc3);
+    }
+    for (; j + 8 <= dim1; j += 8) {
+        auto acc = _mm256_loadu_ps(b + j);
+        for (size_t i = 0; i < dim0; ++i) {
+            acc = _mm256_fmadd_ps(_mm256_set1_ps(x[i]), _mm256_loadu_ps(W + i * dim1 + j), acc);
+        }
+        _mm256_storeu_ps(out + j, acc);
+    }
+    for (; j < dim1; ++j) {
+        float acc = b[j];
+        for (size_t i = 0; i < dim0; ++i) {
+            acc += x[i] * W[i * dim1 + j];
+        }
+        out[j] = acc;
+    }
+}
+
+[[gnu::target("avx2")]] inline void affine_i8(const std::int16_t* x,
+                                             const std::int8_t* W,
+                                             const std::int32_t* b,
+                                             std::int32_t* out,
+                                             const size_t dim0,
+                                             const size_t dim1) {
+    // A single output is a dot product over a contiguous column
+    if (dim1 == 1) {
+        auto acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 16 <= dim0; i += 16) {
+            const auto x_i = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+            const auto w = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(W + i)));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x_i, w));
+        }
+        std::int32_t result = b[0] + hsum(acc);
+        for (; i < dim0; ++i) {
+            result += static_cast<std::int32_t>(x[i]) * W[i];
+        }
+        out[0] = result;
+        return;
+    }
+
+    size_t j = 0;
+    for (; j + 32 <= dim1; j += 32) {
+        auto acc0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+        auto acc1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j + 8));
+        auto acc2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j + 16));
+        auto acc3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j + 24));
+        for (size_t i = 0; i < dim0; ++i) {
+            const auto x_i = _mm256_set1_epi32(x[i]);
+            const auto w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(W + i * dim1 + j));
+            const auto w_lo = _mm256_castsi256_si128(w);
+            const auto w_hi = _mm256_extracti128_si256(w, 1);
+            acc0 = _mm256_add_epi32(acc0, _mm256_mullo_epi32(x_i, _mm256_cvtepi8_epi32(w_lo)));
+            acc1 = _mm256_add_epi32(acc1, _mm256_mullo_epi32(x_i, _mm256_cvtepi8_epi32(_mm_srli_si128(w_lo, 8))));
+            acc2 = _mm256_add_epi32(acc2, _mm256_mullo_epi32(x_i, _mm256_cvtepi8_epi32(w_hi)));
+            acc3 = _mm256_add_epi32(acc3, _mm256_mullo_epi32(x_i, _mm256_cvtepi8_epi32(_mm_srli_si128(w_hi, 8))));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j), acc0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j + 8), acc1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j + 16), acc2);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j + 24), acc3);
+    }
+    for (; j < dim1; ++j) {
+        std::int32_t acc = b[j];
+        for (size_t i = 0; i < dim0; ++i) {
+            acc += static_cast<std::int32_t>(x[i]) * W[i * dim1 + j];
+        }
+        out[j] = acc;
+    }
+}
+
+// Tiles of batch_tile rows by 16 outputs. Every lane sums in the same order as affine_f32, so the results match it.
+[[gnu::target("avx2,fma")]] inline void affine_batch_f32(const float* x,
+                                                        const float* W,
+                                                        const float* b,
+                                                        float* out,
+                                                        const size_t batch,
+                                                        const size_t dim0,
+                                                        const size_t dim1) {
+    size_t r = 0;
+    if (dim1 % 16 == 0) {
+        for (; r + batch_tile <= batch; r += batch_tile) {
+            const float* xr = x + r * dim0;
+            for (size_t j = 0; j < dim1; j += 16) {
+                __m256 acc[batch_tile][2];
+#pragma GCC unroll 4
+                for (size_t k = 0; k < batch_tile; ++k) {
+                    acc[k][0] = _mm256_loadu_ps(b + j);
+                    acc[k][1] = _mm256_loadu_ps(b + j + 8);
+                }
+                for (size_t i = 0; i < dim0; ++i) {
+                    const auto w0 = _mm256_loadu_ps(W + i * dim1 + j);
+                    const auto w1 = _mm256_loadu_ps(W + i * dim1 + j + 8);
+#pragma GCC unroll 4
+                    for (size_t k = 0; k < batch_tile; ++k) {
+                        const auto x_i = _mm256_set1_ps(xr[k * dim0 + i]);
+                        acc[k][0] = _mm256_fmadd_ps(x_i, w0, acc[k][0]);
+                        acc[k][1] = _mm256_fmadd_ps(x_i, w1, acc[k][1]);
+                    }
+                }
+#pragma GCC unroll 4
+                for (size_t k = 0; k < batch_tile; ++k) {
+                    _mm256_storeu_ps(out + (r + k) * dim1 + j, acc[k][0]);
+                    _mm256_storeu_ps(out + (r + k) * dim1 + j + 8, acc[k][1]);
+                }
+            }
+        }
+    }
+    scalar::affine_rows<float, float, float, affine_f32>(x + r * dim0, W, b, out + r * dim1, batch - r, dim0, dim1);
+}
+
+// Tiles of batch_tile rows by 16 outputs, widening each weight once for the whole tile
+[[gnu::target("avx2")]] inline void affine_batch_i8(const std::int16_t* x,
+                                                   const std::int8_t* W,
+                                                   const std::int32_t* b,
+                                                   std::int32_t* out,
+                                                   const size_t batch,
+                                                   const size_t dim0,
+                                                   const size_t dim1) {
+    size_t r = 0;
+    if (dim1 % 16 == 0) {
+        for (; r + batch_tile <= batch; r += batch_tile) {
+            const std::int16_t* xr = x + r * dim0;
+            for (size_t j = 0; j < dim1; j += 16) {
+                __m256i acc[batch_tile][2];
+#pragma GCC unroll 4
+                for (size_t k = 0; k < batch_tile; ++k) {
+                    acc[k][0] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+                    acc[k][1] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j + 8));
+                }
+                for (size_t i = 0; i < dim0; ++i) {
+                    const auto w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(W + i * dim1 + j));
+                    const auto w0 = _mm256_cvtepi8_epi32(w);
+                    const auto w1 = _mm256_cvtepi8_epi32(_mm_srli_si128(w, 8));
+#pragma GCC unroll 4
+                    for (size_t k = 0; k < batch_tile; ++k) {
+                        const auto x_i = _mm256_set1_epi32(xr[k * dim0 + i]);
+                        acc[k][0] = _mm256_add_epi32(acc[k][0], _mm256_mullo_epi32(x_i, w0));
+                        acc[k][1] = _mm256_add_epi32(acc[k][1], _mm256_mullo_epi32(x_i, w1));
+                    }
+                }
+#pragma GCC unroll 4
+                for (size_t k = 0; k < batch_tile; ++k) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + (r + k) * dim1 + j), acc[k][0]);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + (r + k) * dim1 + j + 8), acc[k][1]);
+                }
+            }
+        }
+    }
+    scalar::affine_rows<std::int16_t, std::int8_t, std::int32_t, affine_i8>(
+        x + r * dim0, W, b, out + r * dim1, batch - r, dim0, dim1);
+}
+
+// Eight lanes at a time: a comparison mask, then the offsets of its set bits from nonzero_lookup
+[[gnu::target("avx2")]] inline size_t nonzero_f32(const float* x, const size_t n, std::uint32_t* indices) {
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(x + i), _mm256_setzero_ps(), _CMP_GT_OQ));
+        const auto offsets = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(nonzero_lookup.offsets[mask]));
+        const auto found = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), _mm256_cvtepu8_epi32(offsets));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(indices + count), found);
+        count += __builtin_popcount(mask);
+    }
+    return count + scalar::nonzero(x, i, n, indices + count);
+}
+
+[[gnu::target("avx2")]] inline size_t nonzero_i16(const std::int16_t* x, const size_t n, std::uint32_t* indices) {
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        const auto positive = _mm_cmpgt_epi16(values, _mm_setzero_si128());
+        const int mask = _mm_movemask_epi8(_mm_packs_epi16(positive, _mm_setzero_si128()));
+        const auto offsets = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(nonzero_lookup.offsets[mask]));
+        const auto found = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), _mm256_cvtepu8_epi32(offsets));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(indices + count), found);
+        count += __builtin_popcount(mask);
+    }
+    return count + scalar::nonzero(x, i, n, indices + count);
+}
+
+[[gnu::target("avx2,fma")]] inline void affine_sparse_f32(const float* x,
+                                                         const std::uint32_t* indices,
+                                                         const size_t num_indices,
+                                                         const float* W,
+                                                         const float* b,
+                                                         float* out,
+                                                         const size_t dim1) {
+    size_t j = 0;
+    for (; j + 32 <= dim1; j += 32) {
+        auto acc0 = _mm256_loadu_ps(b + j);
+        auto acc1 = _mm256_loadu_ps(b + j + 8);
+        auto acc2 = _mm256_loadu_ps(b + j + 16);
+        auto acc3 = _mm256_loadu_ps(b + j + 24);
+        for (size_t k = 0; k < num_indices; ++k) {
+            const size_t i = indices[k];
+            const auto x_i = _mm256_set1_ps(x[i]);
+            const float* row = W + i * dim1 + j;
+            acc0 = _mm256_fmadd_ps(x_i, _mm256_loadu_ps(row), acc0);
+            acc1 = _mm256_fmadd_ps(x_i, _mm256_loadu_ps(row + 8), acc1);
+            acc2 = _mm256_fmadd_ps(x_i, _mm256_loadu_ps(row + 16), acc2);
+            acc3 = _mm256_fmadd_ps(x_i, _mm256_loadu_ps(row + 24), acc3);
+        }
+        _mm256_storeu_ps(out + j, acc0);
+        _mm256_storeu_ps(out + j + 8, acc1);
+        _mm256_storeu_ps(out + j + 16, acc2);
+        _mm256_storeu_ps(out + j + 24, acc3);
+    }
+    for (; j + 8 <= dim1; j += 8) {
+        auto acc = _mm256_loadu_ps(b + j);
+        for (size_t k = 0; k < num_indices; ++k) {
+            const size_t i = indices[k];
+            acc = _mm256_fmadd_ps(_mm256_set1_ps(x[i]), _mm256_loadu_ps(W + i * dim1 + j), acc);
+        }
+        _mm256_storeu_ps(out + j, acc);
+    }
+    scalar::affine_sparse(x, indices, num_indices, W, b, out, j, dim1);
+}
+
+[[gnu::target("avx2")]] inline void affine_sparse_i8(const std::int16_t* x,
+                                                    const std::uint32_t* indices,
+                                                    const size_t num_indices,
+                                                    const std::int8_t* W,
+                                                    const std::int32_t* b,
+                                                    std::int32_t* out,
+                                                    const size_t dim1) {
+    size_t j = 0;
+    for (; j + 16 <= dim1; j += 16) {
+        auto acc0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+        auto acc1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j + 8));
+        for (size_t k = 0; k < num_indices; ++k) {
+            const size_t i = indices[k];
+            const auto x_i = _mm256_set1_epi32(x[i]);
+            const auto w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(W + i * dim1 + j));
+            acc0 = _mm256_add_epi32(acc0, _mm256_mullo_epi32(x_i, _mm256_cvtepi8_epi32(w)));
+            acc1 = _mm256_add_epi32(acc1, _mm256_mullo_epi32(x_i, _mm256_cvtepi8_epi32(_mm_srli_si128(w, 8))));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j), acc0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j + 8), acc1);
+    }
+    scalar::affine_sparse(x, indices, num_indices, W, b, out, j, dim1);
+}
+
+[[gnu::target("avx2")]] inline void affine_pairs_i16(const std::int16_t* x,
+                                                    const std::int16_t* P,
+                                                    const std::int32_t* b,
+                                                    std::int32_t* out,
+                                                    const size_t dim0,
+                                                    const size_t dim1) {
+    size_t j = 0;
+    for (; j + 32 <= dim1; j += 32) {
+        auto acc0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+        auto acc1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j + 8));
+        auto acc2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j + 16));
+        auto acc3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j + 24));
+        for (size_t p = 0; p < dim0 / 2; ++p) {
+            const auto x_p = _mm256_set1_epi32(load_pair(x, p));
+            const auto* row = reinterpret_cast<const __m256i*>(P + (p * dim1 + j) * 2);
+            acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(x_p, _mm256_loadu_si256(row)));
+            acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(x_p, _mm256_loadu_si256(row + 1)));
+            acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(x_p, _mm256_loadu_si256(row + 2)));
+            acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(x_p, _mm256_loadu_si256(row + 3)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j), acc0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j + 8), acc1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j + 16), acc2);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j + 24), acc3);
+    }
+    for (; j + 8 <= dim1; j += 8) {
+        auto acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+        for (size_t p = 0; p < dim0 / 2; ++p) {
+            const auto w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(P + (p * dim1 + j) * 2));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_set1_epi32(load_pair(x, p)), w));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j), acc);
+    }
+    scalar::affine_pairs(x, P, b, out, j, dim0, dim1);
+}
+
+[[gnu::target("avx2")]] inline __m256 widen(const bf16* p) {
+    const auto h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+}
+
+[[gnu::target("avx2,f16c")]] inline __m256 widen(const fp16* p) {
+    return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+template <typename R>
+[[gnu::target("avx2,f16c")]] inline void update_half(float* dst,
+                                                     const float* src,
+                                                     const R* const* added,
+                                                     const size_t num_added,
+                                                     const R* const* removed,
+                                                     const size_t num_removed,
+                                                     const size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        auto acc = _mm256_loadu_ps(src + i);
+        for (size_t k = 0; k < num_added; ++k) {
+            acc = _mm256_add_ps(acc, widen(added[k] + i));
+        }
+        for (size_t k = 0; k < num_removed; ++k) {
+            acc = _mm256_sub_ps(acc, widen(removed[k] + i));
+        }
+        _mm256_storeu_ps(dst + i, acc);
+    }
+    scalar::update(dst, src, added, num_added, removed, num_removed, i, n);
+}
+
+inline void update_bf16(float* dst,
+                        const float* src,
+                        const bf16* const* added,
+                        const size_t num_added,
+                        const bf16* const* removed,
+                        const size_t num_removed,
+                        const size_t n) {
+    update_half(dst, src, added, num_added, removed, num_removed, n);
+}
+
+inline void update_fp16(float* dst,
+                        const float* src,
+                        const fp16* const* added,
+                        const size_t num_added,
+                        const fp16* const* removed,
+                        const size_t num_removed,
+                        const size_t n) {
+    update_half(dst, src, added, num_added, removed, num_removed, n);
+}
+
+}  // namespace avx2
+
+namespace avx512 {
+
+[[gnu::target("avx512f,avx512bw")]] inline void add_f32(float* dst, const float* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_loadu_ps(dst + i), _mm512_loadu_ps(src + i)));
+    }
+    scalar::add(dst + i, src + i, n - i);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline void sub_f32(float* dst, const float* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(dst + i, _mm512_sub_ps(_mm512_loadu_ps(dst + i), _mm512_loadu_ps(src + i)));
+    }
+    scalar::sub(dst + i, src + i, n - i);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline void add_i16(std::int16_t* dst, const std::int16_t* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto a = _mm512_loadu_si512(dst + i);
+        const auto b = _mm512_loadu_si512(src + i);
+        _mm512_storeu_si512(dst + i, _mm512_add_epi16(a, b));
+    }
+    scalar::add(dst + i, src + i, n - i);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline void sub_i16(std::int16_t* dst, const std::int16_t* src, const size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const auto a = _mm512_loadu_si512(dst + i);
+        const auto b = _mm512_loadu_si512(src + i);
+        _mm512_storeu_si512(dst + i, _mm512_sub_epi16(a, b));
+    }
+    scalar::sub(dst + i, src + i, n - i);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline void update_f32(float* dst,
+                                                           const float* src,
+                                                           const float* const* added,
+                                                           const size_t num_added,
+                                                           const float* const* removed,
+                                                           const size_t num_removed,
+                                                           const size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto acc = _mm512_loadu_ps(src + i);
+        for (size_t k = 0; k < num_added; ++k) {
+            acc = _mm512_add_ps(acc, _mm512_loadu_ps(added[k] + i));
+        }
+        for (size_t k = 0; k < num_removed; ++k) {
+            acc = _mm512_sub_ps(acc, _mm512_loadu_ps(removed[k] + i));
+        }
+        _mm512_storeu_ps(dst + i, acc);
+    }
+    scalar::update(dst, src, added, num_added, removed, num_removed, i, n);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline void update_i16(std::int16_t* dst,
+                                                           const std::int16_t* src,
+                                                           const std::int16_t* const* added,
+                                                           const size_t num_added,
+                                                           const std::int16_t* const* removed,
+                                                           const size_t num_removed,
+                                                           const size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        auto acc = _mm512_loadu_si512(src + i);
+        for (size_t k = 0; k < num_added; ++k) {
+            acc = _mm512_add_epi16(acc, _mm512_loadu_si512(added[k] + i));
+        }
+        for (size_t k = 0; k < num_removed; ++k) {
+            acc = _mm512_sub_epi16(acc, _mm512_loadu_si512(removed[k] + i));
+        }
+        _mm512_storeu_si512(dst + i, acc);
+    }
+    scalar::update(dst, src, added, num_added, removed, num_removed, i, n);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline void affine_f32(const float* x,
+                                                          const float* W,
+                                                          const float* b,
+                                                          float* out,
+                                                          const size_t dim0,
+                                                          const size_t dim1) {
+    // A single output is a dot product over a contiguous column
+    if (dim1 == 1) {
+        auto acc = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= dim0; i += 16) {
+            acc = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(W + i), acc);
+        }
+        float result = b[0] + _mm512_reduce_add_ps(acc);
+        for (; i < dim0; ++i) {
+            result += x[i] * W[i];
+        }
+        out[0] = result;
+        return;
+    }
+
+    size_t j = 0;
+    for (; j + 32 <= dim1; j += 32) {
+        auto acc0 = _mm512_loadu_ps(b + j);
+        auto acc1 = _mm512_loadu_ps(b + j + 16);
+        for (size_t i = 0; i < dim0; ++i) {
+            const auto x_i = _mm512_set1_ps(x[i]);
+            acc0 = _mm512_fmadd_ps(x_i, _mm512_loadu_ps(W + i * dim1 + j), acc0);
+            acc1 = _mm512_fmadd_ps(x_i, _mm512_loadu_ps(W + i * dim1 + j + 16), acc1);
+        }
+        _mm512_storeu_ps(out + j, acc0);
+        _mm512_storeu_ps(out + j + 16, acc1);
+    }
+    for (; j + 16 <= dim1; j += 16) {
+        auto acc = _mm512_loadu_ps(b + j);
+        for (size_t i = 0; i < dim0; ++i) {
+            acc = _mm512_fmadd_ps(_mm512_set1_ps(x[i]), _mm512_loadu_ps(W + i * dim1 + j), acc);
+        }
+        _mm512_storeu_ps(out + j, acc);
+    }
+    for (; j < dim1; ++j) {
+        float acc = b[j];
+        for (size_t i = 0; i < dim0; ++i) {
+            acc += x[i] * W[i * dim1 + j];
+        }
+        out[j] = acc;
+    }
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline void affine_i8(const std::int16_t* x,
+                                                         const std::int8_t* W,
+                                                         const std::int32_t* b,
+                                                         std::int32_t* out,
+                                                         const size_t dim0,
+                                                         const size_t dim1) {
+    // A single output is a dot product over a contiguous column
+    if (dim1 == 1) {
+        auto acc = _mm512_setzero_si512();
+        size_t i = 0;
+        for (; i + 32 <= dim0; i += 32) {
+            const auto x_i = _mm512_loadu_si512(x + i);
+            const auto w = _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(W + i)));
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(x_i, w));
+        }
+        std::int32_t result = b[0] + _mm512_reduce_add_epi32(acc);
+        for (; i < dim0; ++i) {
+            result += static_cast<std::int32_t>(x[i]) * W[i];
+        }
+        out[0] = result;
+        return;
+    }
+
+    size_t j = 0;
+    for (; j + 32 <= dim1; j += 32) {
+        auto acc0 = _mm512_loadu_si512(b + j);
+        auto acc1 = _mm512_loadu_si512(b + j + 16);
+        for (size_t i = 0; i < dim0; ++i) {
+            const auto x_i = _mm512_set1_epi32(x[i]);
+            const auto w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(W + i * dim1 + j));
+            acc0 = _mm512_add_epi32(acc0, _mm512_mullo_epi32(x_i, _mm512_cvtepi8_epi32(_mm256_castsi256_si128(w))));
+            const auto w_hi = _mm256_extracti128_si256(w, 1);
+            acc1 = _mm512_add_epi32(acc1, _mm512_mullo_epi32(x_i, _mm512_cvtepi8_epi32(w_hi)));
+        }
+        _mm512_storeu_si512(out + j, acc0);
+        _mm512_storeu_si512(out + j + 16, acc1);
+    }
+    for (; j < dim1; ++j) {
+        std::int32_t acc = b[j];
+        for (size_t i = 0; i < dim0; ++i) {
+            acc += static_cast<std::int32_t>(x[i]) * W[i * dim1 + j];
+        }
+        out[j] = acc;
+    }
+}
+
+// Tiles of batch_tile rows by 32 outputs. Every lane sums in the same order as affine_f32, so the results match it.
+[[gnu::target("avx512f,avx512bw")]] inline void affine_batch_f32(const float* x,
+                                                                const float* W,
+                                                                const float* b,
+                                                                float* out,
+                                                                const size_t batch,
+                                                                const size_t dim0,
+                                                                const size_t dim1) {
+    size_t r = 0;
+    if (dim1 % 32 == 0) {
+        for (; r + batch_tile <= batch; r += batch_tile) {
+            const float* xr = x + r * dim0;
+            for (size_t j = 0; j < dim1; j += 32) {
+                __m512 acc[batch_tile][2];
+#pragma GCC unroll 4
+                for (size_t k = 0; k < batch_tile; ++k) {
+                    acc[k][0] = _mm512_loadu_ps(b + j);
+                    acc[k][1] = _mm512_loadu_ps(b + j + 16);
+                }
+                for (size_t i = 0; i < dim0; ++i) {
+                    const auto w0 = _mm512_loadu_ps(W + i * dim1 + j);
+                    const auto w1 = _mm512_loadu_ps(W + i * dim1 + j + 16);
+#pragma GCC unroll 4
+                    for (size_t k = 0; k < batch_tile; ++k) {
+                        const auto x_i = _mm512_set1_ps(xr[k * dim0 + i]);
+                        acc[k][0] = _mm512_fmadd_ps(x_i, w0, acc[k][0]);
+                        acc[k][1] = _mm512_fmadd_ps(x_i, w1, acc[k][1]);
+                    }
+                }
+#pragma GCC unroll 4
+                for (size_t k = 0; k < batch_tile; ++k) {
+                    _mm512_storeu_ps(out + (r + k) * dim1 + j, acc[k][0]);
+                    _mm512_storeu_ps(out + (r + k) * dim1 + j + 16, acc[k][1]);
+                }
+            }
+        }
+    }
+    scalar::affine_rows<float, float, float, affine_f32>(x + r * dim0, W, b, out + r * dim1, batch - r, dim0, dim1);
+}
+
+// Tiles of batch_tile rows by 32 outputs, widening each weight once for the whole tile
+[[gnu::target("avx512f,avx512bw")]] inline void affine_batch_i8(const std::int16_t* x,
+                                                               const std::int8_t* W,
+                                                               const std::int32_t* b,
+                                                               std::int32_t* out,
+                                                               const size_t batch,
+                                                               const size_t dim0,
+                                                               const size_t dim1) {
+    size_t r = 0;
+    if (dim1 % 32 == 0) {
+        for (; r + batch_tile <= batch; r += batch_tile) {
+            const std::int16_t* xr = x + r * dim0;
+            for (size_t j = 0; j < dim1; j += 32) {
+                __m512i acc[batch_tile][2];
+#pragma GCC unroll 4
+                for (size_t k = 0; k < batch_tile; ++k) {
+                    acc[k][0] = _mm512_loadu_si512(b + j);
+                    acc[k][1] = _mm512_loadu_si512(b + j + 16);
+                }
+                for (size_t i = 0; i < dim0; ++i) {
+                    const auto w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(W + i * dim1 + j));
+                    const auto w0 = _mm512_cvtepi8_epi32(_mm256_castsi256_si128(w));
+                    const auto w1 = _mm512_cvtepi8_epi32(_mm256_extracti128_si256(w, 1));
+#pragma GCC unroll 4
+                    for (size_t k = 0; k < batch_tile; ++k) {
+                        const auto x_i = _mm512_set1_epi32(xr[k * dim0 + i]);
+                        acc[k][0] = _mm512_add_epi32(acc[k][0], _mm512_mullo_epi32(x_i, w0));
+                        acc[k][1] = _mm512_add_epi32(acc[k][1], _mm512_mullo_epi32(x_i, w1));
+                    }
+                }
+#pragma GCC unroll 4
+                for (size_t k = 0; k < batch_tile; ++k) {
+                    _mm512_storeu_si512(out + (r + k) * dim1 + j, acc[k][0]);
+                    _mm512_storeu_si512(out + (r + k) * dim1 + j + 16, acc[k][1]);
+                }
+            }
+        }
+    }
+    scalar::affine_rows<std::int16_t, std::int8_t, std::int32_t, affine_i8>(
+        x + r * dim0, W, b, out + r * dim1, batch - r, dim0, dim1);
+}
+
+// A comparison mask per block of lanes, compressed straight into indices
+[[gnu::target("avx512f,avx512bw")]] inline size_t nonzero_f32(const float* x,
+                                                             const size_t n,
+                                                             std::uint32_t* indices) {
+    size_t count = 0;
+    size_t i = 0;
+    auto lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    for (; i + 16 <= n; i += 16) {
+        const __mmask16 mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(x + i), _mm512_setzero_ps(), _CMP_GT_OQ);
+        _mm512_mask_compressstoreu_epi32(indices + count, mask, lanes);
+        count += __builtin_popcount(mask);
+        lanes = _mm512_add_epi32(lanes, _mm512_set1_epi32(16));
+    }
+    return count + scalar::nonzero(x, i, n, indices + count);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline size_t nonzero_i16(const std::int16_t* x,
+                                                             const size_t n,
+                                                             std::uint32_t* indices) {
+    size_t count = 0;
+    size_t i = 0;
+    auto lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    for (; i + 32 <= n; i += 32) {
+        const __mmask32 mask = _mm512_cmpgt_epi16_mask(_mm512_loadu_si512(x + i), _mm512_setzero_si512());
+        const auto lo = static_cast<__mmask16>(mask);
+        const auto hi = static_cast<__mmask16>(mask >> 16);
+        _mm512_mask_compressstoreu_epi32(indices + count, lo, lanes);
+        count += __builtin_popcount(lo);
+        _mm512_mask_compressstoreu_epi32(indices + count, hi, _mm512_add_epi32(lanes, _mm512_set1_epi32(16)));
+        count += __builtin_popcount(hi);
+        lanes = _mm512_add_epi32(lanes, _mm512_set1_epi32(32));
+    }
+    return count + scalar::nonzero(x, i, n, indices + count);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline void affine_sparse_f32(const float* x,
+                                                                 const std::uint32_t* indices,
+                                                                 const size_t num_indices,
+                                                                 const float* W,
+                                                                 const float* b,
+                                                                 float* out,
+                                                                 const size_t dim1) {
+    size_t j = 0;
+    for (; j + 32 <= dim1; j += 32) {
+        auto acc0 = _mm512_loadu_ps(b + j);
+        auto acc1 = _mm512_loadu_ps(b + j + 16);
+        for (size_t k = 0; k < num_indices; ++k) {
+            const size_t i = indices[k];
+            const auto x_i = _mm512_set1_ps(x[i]);
+            acc0 = _mm512_fmadd_ps(x_i, _mm512_loadu_ps(W + i * dim1 + j), acc0);
+            acc1 = _mm512_fmadd_ps(x_i, _mm512_loadu_ps(W + i * dim1 + j + 16), acc1);
+        }
+        _mm512_storeu_ps(out + j, acc0);
+        _mm512_storeu_ps(out + j + 16, acc1);
+    }
+    for (; j + 16 <= dim1; j += 16) {
+        auto acc = _mm512_loadu_ps(b + j);
+        for (size_t k = 0; k < num_indices; ++k) {
+            const size_t i = indices[k];
+            acc = _mm512_fmadd_ps(_mm512_set1_ps(x[i]), _mm512_loadu_ps(W + i * dim1 + j), acc);
+        }
+        _mm512_storeu_ps(out + j, acc);
+    }
+    scalar::affine_sparse(x, indices, num_indices, W, b, out, j, dim1);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline void affine_sparse_i8(const std::int16_t* x,
+                                                                const std::uint32_t* indices,
+                                                                const size_t num_indices,
+                                                                const std::int8_t* W,
+                                                                const std::int32_t* b,
+                                                                std::int32_t* out,
+                                                                const size_t dim1) {
+    size_t j = 0;
+    for (; j + 32 <= dim1; j += 32) {
+        auto acc0 = _mm512_loadu_si512(b + j);
+        auto acc1 = _mm512_loadu_si512(b + j + 16);
+        for (size_t k = 0; k < num_indices; ++k) {
+            const size_t i = indices[k];
+            const auto x_i = _mm512_set1_epi32(x[i]);
+            const auto w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(W + i * dim1 + j));
+            acc0 = _mm512_add_epi32(acc0, _mm512_mullo_epi32(x_i, _mm512_cvtepi8_epi32(_mm256_castsi256_si128(w))));
+            const auto w_hi = _mm256_extracti128_si256(w, 1);
+            acc1 = _mm512_add_epi32(acc1, _mm512_mullo_epi32(x_i, _mm512_cvtepi8_epi32(w_hi)));
+        }
+        _mm512_storeu_si512(out + j, acc0);
+        _mm512_storeu_si512(out + j + 16, acc1);
+    }
+    scalar::affine_sparse(x, indices, num_indices, W, b, out, j, dim1);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline void affine_pairs_i16(const std::int16_t* x,
+                                                                const std::int16_t* P,
+                                                                const std::int32_t* b,
+                                                                std::int32_t* out,
+                                                                const size_t dim0,
+                                                                const size_t dim1) {
+    size_t j = 0;
+    for (; j + 32 <= dim1; j += 32) {
+        auto acc0 = _mm512_loadu_si512(b + j);
+        auto acc1 = _mm512_loadu_si512(b + j + 16);
+        for (size_t p = 0; p < dim0 / 2; ++p) {
+            const auto x_p = _mm512_set1_epi32(load_pair(x, p));
+            const std::int16_t* row = P + (p * dim1 + j) * 2;
+            acc0 = _mm512_add_epi32(acc0, _mm512_madd_epi16(x_p, _mm512_loadu_si512(row)));
+            acc1 = _mm512_add_epi32(acc1, _mm512_madd_epi16(x_p, _mm512_loadu_si512(row + 32)));
+        }
+        _mm512_storeu_si512(out + j, acc0);
+        _mm512_storeu_si512(out + j + 16, acc1);
+    }
+    for (; j + 16 <= dim1; j += 16) {
+        auto acc = _mm512_loadu_si512(b + j);
+        for (size_t p = 0; p < dim0 / 2; ++p) {
+            const auto w = _mm512_loadu_si512(P + (p * dim1 + j) * 2);
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(_mm512_set1_epi32(load_pair(x, p)), w));
+        }
+        _mm512_storeu_si512(out + j, acc);
+    }
+    scalar::affine_pairs(x, P, b, out, j, dim0, dim1);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline __m512 widen(const bf16* p) {
+    const auto h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline __m512 widen(const fp16* p) {
+    return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+}
+
+template <typename R>
+[[gnu::target("avx512f,avx512bw")]] inline void update_half(float* dst,
+                                                            const float* src,
+                                                            const R* const* added,
+                                                            const size_t num_added,
+                                                            const R* const* removed,
+                                                            const size_t num_removed,
+                                                            const size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto acc = _mm512_loadu_ps(src + i);
+        for (size_t k = 0; k < num_added; ++k) {
+            acc = _mm512_add_ps(acc, widen(added[k] + i));
+        }
+        for (size_t k = 0; k < num_removed; ++k) {
+            acc = _mm512_sub_ps(acc, widen(removed[k] + i));
+        }
+        _mm512_storeu_ps(dst + i, acc);
+    }
+    scalar::update(dst, src, added, num_added, removed, num_removed, i, n);
+}
+
+inline void update_bf16(float* dst,
+                        const float* src,
+                        const bf16* const* added,
+                        const size_t num_added,
+                        const bf16* const* removed,
+                        const size_t num_removed,
+                        const size_t n) {
+    update_half(dst, src, added, num_added, removed, num_removed, n);
+}
+
+inline void update_fp16(float* dst,
+                        const float* src,
+                        const fp16* const* added,
+                        const size_t num_added,
+                        const fp16* const* removed,
+                        const size_t num_removed,
+                        const size_t n) {
+    update_half(dst, src, added, num_added, removed, num_removed, n);
+}
+
+}  // namespace avx512
+
+inline kernels make_kernels(const instruction_set isa) {
+    switch (isa) {
+        case instruction_set::avx512:
+            return {isa,
+                    avx512::add_f32,
+                    avx512::sub_f32,
+                    avx512::add_i16,
+                    avx512::sub_i16,
+                    avx512::update_f32,
+                    avx512::update_i16,
+                    avx512::affine_f32,
+                    avx512::affine_i8,
+                    avx512::affine_batch_f32,
+                    avx512::affine_batch_i8,
+                    avx512::nonzero_f32,
+                    avx512::nonzero_i16,
+                    avx512::affine_sparse_f32,
+                    avx512::affine_sparse_i8,
+                    avx512::affine_pairs_i16,
+                    avx512::update_bf16,
+                    avx512::update_fp16};
+        case instruction_set::avx2:
+            return {isa,
+                    avx2::add_f32,
+                    avx2::sub_f32,
+                    avx2::add_i16,
+                    avx2::sub_i16,
+                    avx2::update_f32,
+                    avx2::update_i16,
+                    avx2::affine_f32,
+                    avx2::affine_i8,
+                    avx2::affine_batch_f32,
+                    avx2::affine_batch_i8,
+                    avx2::nonzero_f32,
+                    avx2::nonzero_i16,
+                    avx2::affine_sparse_f32,
+                    avx2::affine_sparse_i8,
+                    avx2::affine_pairs_i16,
+                    avx2::update_bf16,
+                    avx2::update_fp16};
+        case instruction_set::sse41:
+            return {isa,
+                    sse41::add_f32,
+                    sse41::sub_f32,
+                    sse41::add_i16,
+                    sse41::sub_i16,
+                    sse41::update_f32,
+                    sse41::update_i16,
+                    sse41::affine_f32,
+                    sse41::affine_i8,
+                    sse41::affine_batch_f32,
+                    sse41::affine_batch_i8,
+                    sse41::nonzero_f32,
+                    sse41::nonzero_i16,
+                    sse41::affine_sparse_f32,
+                    sse41::affine_sparse_i8,
+                    sse41::affine_pairs_i16,
+                    sse41::update_bf16,
+                    sse41::update_fp16};
+        default:
+            return {instruction_set::scalar,
+                    scalar::add_f32,
+                    scalar::sub_f32,
+                    scalar::add_i16,
+                    scalar::sub_i16,
+                    scalar::update_f32,
+                    scalar::update_i16,
+                    scalar::affine_f32,
+                    scalar::affine_i8,
+                    scalar::affine_batch_f32,
+                    scalar::affine_batch_i8,
+                    scalar::nonzero_f32,
+                    scalar::nonzero_i16,
+                    scalar::affine_sparse_f32,
+                    scalar::affine_sparse_i8,
+                    scalar::affine_pairs_i16,
+                    scalar::update_bf16,
+                    scalar::update_fp16};
+    }
+}
+
+// Best instruction set supported by the running CPU
+inline instruction_set detect() noexcept {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return instruction_set::avx512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) {
+        return instruction_set::avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        return instruction_set::sse41;
+    }
+    return instruction_set::scalar;
+}
+
+inline const char* name(const instruction_set isa) noexcept {
+    switch (isa) {
+        case instruction_set::avx512:
+            return "avx512";
+        case instruction_set::avx2:
+            return "avx2";
+        case instruction_set::sse41:
+            return "sse4.1";
+        default:
+            return "scalar";
+    }
+}
+
+// Kernel table picked once at startup from CPUID
+inline kernels active = make_kernels(detect());
+
+// Force a particular instruction set, e.g. to compare kernels. Requests the CPU can't run are ignored.
+inline bool select(const instruction_set isa) noexcept {
+    if (static_cast<std::uint8_t>(isa) > static_cast<std::uint8_t>(detect())) {
+        return false;
+    }
+    active = make_kernels(isa);
+    return true;
+}
+
+inline void add(float* dst, const float* src, const size_t n) {
+    active.add_f32(dst, src, n);
+}
+
+inline void add(std::int16_t* dst, const std::int16_t* src, const size_t n) {
+    active.add_i16(dst, src, n);
+}
+
+template <typename T>
+inline void add(T* dst, const T* src, const size_t n) {
+    scalar::add(dst, src, n);
+}
+
+inline void sub(float* dst, const float* src, const size_t n) {
+    active.sub_f32(dst, src, n);
+}
+
+inline void sub(std::int16_t* dst, const std::int16_t* src, const size_t n) {
+    active.sub_i16(dst, src, n);
+}
+
+template <typename T>
+inline void sub(T* dst, const T* src, const size_t n) {
+    scalar::sub(dst, src, n);
+}
+
+inline void update(float* dst,
+                   const float* src,
+                   const float* const* added,
+                   const size_t num_added,
+                   const float* const* removed,
+                   const size_t num_removed,
+                   const size_t n) {
+    active.update_f32(dst, src, added, num_added, removed, num_removed, n);
+}
+
+inline void update(std::int16_t* dst,
+                   const std::int16_t* src,
+                   const std::int16_t* const* added,
+                   const size_t num_added,
+                   const std::int16_t* const* removed,
+                   const size_t num_removed,
+                   const size_t n) {
+    active.update_i16(dst, src, added, num_added, removed, num_removed, n);
+}
+
+inline void update(float* dst,
+                   const float* src,
+                   const bf16* const* added,
+                   const size_t num_added,
+                   const bf16* const* removed,
+                   const size_t num_removed,
+                   const size_t n) {
+    active.update_bf16(dst, src, added, num_added, removed, num_removed, n);
+}
+
+inline void update(float* dst,
+                   const float* src,
+                   const fp16* const* added,
+                   const size_t num_added,
+                   const fp16* const* removed,
+                   const size_t num_removed,
+                   const size_t n) {
+    active.update_fp16(dst, src, added, num_added, removed, num_removed, n);
+}
+
+template <typename T>
+inline void update(T* dst,
+                   const T* src,
+                   const T* const* added,
+                   const size_t num_added,
+                   const T* const* removed,
+                   const size_t num_removed,
+                   const size_t n) {
+    scalar::update(dst, src, added, num_added, removed, num_removed, 0, n);
+}
+
+inline void affine(const float* x, const float* W, const float* b, float* out, const size_t dim0, const size_t dim1) {
+    active.affine_f32(x, W, b, out, dim0, dim1);
+}
+
+inline void affine(const std::int16_t* x,
+                   const std::int8_t* W,
+                   const std::int32_t* b,
+                   std::int32_t* out,
+                   const size_t dim0,
+                   const size_t dim1) {
+    active.affine_i8(x, W, b, out, dim0, dim1);
+}
+
+template <typename X, typename W, typename A>
+inline void affine(const X* x, const W* w, const A* b, A* out, const size_t dim0, const size_t dim1) {
+    scalar::affine(x, w, b, out, dim0, dim1);
+}
+
+inline void affine_batch(const float* x,
+                         const float* W,
+                         const float* b,
+                         float* out,
+                         const size_t batch,
+                         const size_t dim0,
+                         const size_t dim1) {
+    active.affine_batch_f32(x, W, b, out, batch, dim0, dim1);
+}
+
+inline void affine_batch(const std::int16_t* x,
+                         const std::int8_t* W,
+                         const std::int32_t* b,
+                         std::int32_t* out,
+                         const size_t batch,
+                         const size_t dim0,
+                         const size_t dim1) {
+    active.affine_batch_i8(x, W, b, out, batch, dim0, dim1);
+}
+
+template <typename X, typename W, typename A>
+inline void affine_batch(const X* x,
+                         const W* w,
+                         const A* b,
+                         A* out,
+                         const size_t batch,
+                         const size_t dim0,
+                         const size_t dim1) {
+    for (size_t r = 0; r < batch; ++r) {
+        scalar::affine(x + r * dim0, w, b, out + r * dim1, dim0, dim1);
+    }
+}
+
+inline size_t nonzero(const float* x, const size_t n, std::uint32_t* indices) {
+    return active.nonzero_f32(x, n, indices);
+}
+
+inline size_t nonzero(const std::int16_t* x, const size_t n, std::uint32_t* indices) {
+    return active.nonzero_i16(x, n, indices);
+}
+
+template <typename T>
+inline size_t nonzero(const T* x, const size_t n, std::uint32_t* indices) {
+    return scalar::nonzero(x, 0, n, indices);
+}
+
+inline void affine_sparse(const float* x,
+                          const std::uint32_t* indices,
+                          const size_t num_indices,
+                          const float* W,
+                          const float* b,
+                          float* out,
+                          const size_t dim1) {
+    active.affine_sparse_f32(x, indices, num_indices, W, b, out, dim1);
+}
+
+inline void affine_sparse(const std::int16_t* x,
+                          const std::uint32_t* indices,
+                          const size_t num_indices,
+                          const std::int8_t* W,
+                          const std::int32_t* b,
+                          std::int32_t* out,
+                          const size_t dim1) {
+    active.affine_sparse_i8(x, indices, num_indices, W, b, out, dim1);
+}
+
+template <typename X, typename W, typename A>
+inline void affine_sparse(const X* x,
+                          const std::uint32_t* indices,
+                          const size_t num_indices,
+                          const W* w,
+                          const A* b,
+                          A* out,
+                          const size_t dim1) {
+    scalar::affine_sparse(x, indices, num_indices, w, b, out, 0, dim1);
+}
+
+inline void affine_pairs(const std::int16_t* x,
+                         const std::int16_t* P,
+                         const std::int32_t* b,
+                         std::int32_t* out,
+                         const size_t dim0,
+                         const size_t dim1) {
+    active.affine_pairs_i16(x, P, b, out, dim0, dim1);
+}
+
+}  // namespace simd
+
+}  // namespace nnue
@@ -1,8 +1,13 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <type_traits>
 #include <utility>
+#include "nnue_simd.hpp"
 #include "weights_streamer.hpp"
 
 namespace nnue {
@@ -12,9 +17,27 @@ constexpr T relu(const T& x) {
     return std::max(x, T{0});
 }
 
+// Zeroed heap arrays starting on a cache line
+template <typename T>
+struct aligned_delete {
+    void operator()(T* p) const {
+        ::operator delete[](p, std::align_val_t{cache_line});
+    }
+};
+
+template <typename T>
+using aligned_array = std::unique_ptr<T[], aligned_delete<T>>;
+
+template <typename T>
+aligned_array<T> make_aligned(const size_t numel) {
+    T* p = static_cast<T*>(::operator new[](numel * sizeof(T), std::align_val_t{cache_line}));
+    std::fill(p, p + numel, T{});
+    return aligned_array<T>(p);
+}
+
 template <typename T, size_t dim>
 struct stack_vector {
-    T data[dim];
+    alignas(cache_line) T data[dim];
 
     template <typename F>
     constexpr stack_vector<T, dim> apply(F&& f) const {
@@ -31,18 +54,12 @@ struct stack_vector {
     }
 
     constexpr stack_vector<T, dim>& add_(const T* other) {
-#pragma omp simd
-        for (size_t i = 0; i < dim; ++i) {
-            data[i] += other[i];
-        }
+        simd::add(data, other, dim);
         return *this;
     }
 
     constexpr stack_vector<T, dim>& sub_(const T* other) {
-#pragma omp simd
-        for (size_t i = 0; i < dim; ++i) {
-            data[i] -= other[i];
-        }
+        simd::sub(data, other, dim);
         return *this;
     }
 
@@ -124,106 +141,225 @@ struct stack_affine {
     static constexpr size_t W_numel = dim0 * dim1;
     static constexpr size_t b_numel = dim1;
 
-    T W[W_numel];
-    T b[b_numel];
+    alignas(cache_line) T W[W_numel];
+    alignas(cache_line) T b[b_numel];
 
     constexpr size_t num_parameters() const {
         return W_numel + b_numel;
     }
 
     constexpr stack_vector<T, dim1> forward(const stack_vector<T, dim0>& x) const {
-        auto result = stack_vector<T, dim1>::from(b);
-#pragma omp simd
-        for (size_t i = 0; i < dim0; ++i) {
-            result.fma_(x.data[i], W + i * dim1);
-        }
+        stack_vector<T, dim1> result;
+        simd::affine(x.data, W, b, result.data, dim0, dim1);
         return result;
     }
 
+    // forward for batch inputs stored one after the other, see simd::affine_batch
+    void forward_batch(const T* x, T* out, const size_t batch) const {
+        simd::affine_batch(x, W, b, out, batch, dim0, dim1);
+    }
+
+    // forward(relu(x)), reading only the weight rows of the positive inputs. Worth it after a relu, which
+    // zeroes a large share of the inputs.
     constexpr stack_vector<T, dim1> relu_forward(const stack_vector<T, dim0>& x) const {
-        auto result = stack_vector<T, dim1>::from(b);
-        for (size_t i = 0; i < dim0; ++i) {
-            if (x.data[i] > T{0}) {
-                result.fma_(x.data[i], W + i * dim1);
-            }
-        }
+        std::uint32_t indices[dim0 + simd::nonzero_slack];
+        const size_t num_indices = simd::nonzero(x.data, dim0, indices);
+        stack_vector<T, dim1> result;
+        simd::affine_sparse(x.data, indices, num_indices, W, b, result.data, dim1);
         return result;
     }
 
-    stack_affine<T, dim0, dim1>& load_(weights_streamer<T>& ws) {
+    stack_affine<T, dim0, dim1>& load_(weights_streamer& ws) {
         ws.stream(W, W_numel).stream(b, b_numel);
         return *this;
     }
+
+    void save_(weights_writer& ww) const {
+        ww.write(W, W_numel).write(b, b_numel);
+    }
 };
 
-template <typename T, size_t dim0, size_t dim1>
+// Row is the storage type of W and F, T by default. Float rows can be kept as bf16 or fp16, see nnue_half.hpp.
+template <typename T, size_t dim0, size_t dim1, typename Row = T>
 struct big_affine {
+    static_assert(dim0 % 2 == 0, "expected a half-ka feature layout");
+
     static constexpr size_t W_numel = dim0 * dim1;
     static constexpr size_t b_numel = dim1;
 
-    T* W{nullptr};
-    T b[b_numel];
+    // One derived flip row per square, W[sq] - W[dim0 / 2 + sq], so turning a stone over is a single row
+    // instead of an erase plus an insert. Flip rows are numbered after the dim0 feature rows.
+    static constexpr size_t flip_numel = (dim0 / 2) * dim1;
+
+    // W is owned, or after loading points straight into the weights file which mapping_ keeps alive.
+    // The flip rows F are owned unless attached to a shared network together with W. Both start on a cache
+    // line: the file keeps W aligned for a mapping.
+    Row* W{nullptr};
+    alignas(cache_line) T b[b_numel]{};
+    Row* F{nullptr};
+    aligned_array<Row> owned_{};
+    weights_mapping mapping_{};
 
     constexpr size_t num_parameters() const {
         return W_numel + b_numel;
     }
 
+    // True if W points into a loaded weights file rather than owned memory
+    bool borrowed() const {
+        return mapping_.data() != nullptr;
+    }
+
+    static constexpr size_t flip_idx(const size_t sq) {
+        return dim0 + sq;
+    }
+
+    constexpr const Row* row(const size_t idx) const {
+        return idx < dim0 ? W + idx * dim1 : F + (idx - dim0) * dim1;
+    }
+
+    // Rebuild the flip rows after W changed. Integer rows may wrap, which is harmless as the
+    // accumulators are summed modulo 2^n and always end up in range.
+    big_affine<T, dim0, dim1, Row>& derive_flips_() {
+        constexpr size_t squares = dim0 / 2;
+        for (size_t sq = 0; sq < squares; ++sq) {
+            T* flip = F + sq * dim1;
+            const T* us = W + sq * dim1;
+            const T* them = W + (squares + sq) * dim1;
+            for (size_t j = 0; j < dim1; ++j) {
+                flip[j] = static_cast<T>(us[j] - them[j]);
+            }
+        }
+        return *this;
+    }
+
     void insert_idx(const size_t idx, stack_vector<T, b_numel>& x) const {
-        const T* mem_region = W + idx * dim1;
-        x.add_(mem_region);
+        if constexpr (std::is_same_v<Row, T>) {
+            x.add_(row(idx));
+        } else {
+            const Row* added = row(idx);
+            simd::update(x.data, x.data, &added, 1, static_cast<const Row* const*>(nullptr), 0, dim1);
+        }
     }
 
     void erase_idx(const size_t idx, stack_vector<T, b_numel>& x) const {
-        const T* mem_region = W + idx * dim1;
-        x.sub_(mem_region);
+        if constexpr (std::is_same_v<Row, T>) {
+            x.sub_(row(idx));
+        } else {
+            const Row* removed = row(idx);
+            simd::update(x.data, x.data, static_cast<const Row* const*>(nullptr), 0, &removed, 1, dim1);
+        }
     }
 
-    big_affine<T, dim0, dim1>& load_(weights_streamer<T>& ws) {
-        ws.stream(W, W_numel).stream(b, b_numel);
+    // Narrowed copy of the rows of src, flip rows included, which are rounded from their exact values
+    big_affine<T, dim0, dim1, Row>& narrow_(const big_affine<T, dim0, dim1>& src) {
+        allocate_();
+        for (size_t i = 0; i < W_numel; ++i) {
+            W[i] = Row::from(src.W[i]);
+        }
+        for (size_t i = 0; i < flip_numel; ++i) {
+            F[i] = Row::from(src.F[i]);
+        }
+        std::copy(src.b, src.b + b_numel, b);
         return *this;
     }
 
-    big_affine<T, dim0, dim1>& operator=(const big_affine<T, dim0, dim1>& other) {
-#pragma omp simd
-        for (size_t i = 0; i < W_numel; ++i) {
-            W[i] = other.W[i];
+    // W is used in place when the file allows it, otherwise it is copied out. Narrower rows are converted
+    // from the file's T.
+    big_affine<T, dim0, dim1, Row>& load_(weights_streamer& ws) {
+        if constexpr (!std::is_same_v<Row, T>) {
+            big_affine<T, dim0, dim1> exact{};
+            exact.load_(ws);
+            return narrow_(exact);
+        } else {
+            if (const T* view = ws.view<T>(W_numel)) {
+                // Mapped pages are read-only, W is never written through once it is borrowed
+                W = const_cast<T*>(view);
+                mapping_ = ws.mapping();
+                owned_ = make_aligned<T>(flip_numel);
+                F = owned_.get();
+            } else {
+                allocate_();
+                ws.stream(W, W_numel);
+            }
+            ws.stream(b, b_numel);
+            return derive_flips_();
         }
-        for (size_t i = 0; i < b_numel; ++i) {
-            b[i] = other.b[i];
+    }
+
+    void save_(weights_writer& ww) const {
+        static_assert(std::is_same_v<Row, T>, "files hold full precision rows");
+        ww.write(W, W_numel).write(b, b_numel);
+    }
+
+    // The layout in memory, flip rows included, as read back by attach_()
+    void share_(weights_writer& ww) const {
+        static_assert((W_numel * sizeof(Row)) % cache_line == 0 && (flip_numel * sizeof(Row)) % cache_line == 0,
+                      "shared rows must keep the next ones aligned");
+        ww.write(W, W_numel).write(F, flip_numel).write(b, b_numel);
+    }
+
+    // Use W and F in place from what share_() wrote, e.g. a network in shared memory
+    big_affine<T, dim0, dim1, Row>& attach_(weights_streamer& ws) {
+        const Row* w_view = ws.view<Row>(W_numel);
+        const Row* f_view = ws.view<Row>(flip_numel);
+        if (w_view == nullptr || f_view == nullptr) {
+            throw load_error("nnue " + ws.name_ + ": shared network is truncated");
         }
+        W = const_cast<Row*>(w_view);
+        F = const_cast<Row*>(f_view);
+        owned_.reset();
+        mapping_ = ws.mapping();
+        ws.stream(b, b_numel);
         return *this;
     }
 
-    big_affine<T, dim0, dim1>& operator=(big_affine<T, dim0, dim1>&& other) {
+    big_affine<T, dim0, dim1, Row>& operator=(const big_affine<T, dim0, dim1, Row>& other) {
+        auto copy = big_affine<T, dim0, dim1, Row>(other);
+        return *this = std::move(copy);
+    }
+
+    big_affine<T, dim0, dim1, Row>& operator=(big_affine<T, dim0, dim1, Row>&& other) {
         std::swap(W, other.W);
         std::swap(b, other.b);
+        std::swap(F, other.F);
+        std::swap(owned_, other.owned_);
+        std::swap(mapping_, other.mapping_);
         return *this;
     }
 
-    big_affine(const big_affine<T, dim0, dim1>& other) {
-        W = new T[W_numel];
-#pragma omp simd
-        for (size_t i = 0; i < W_numel; ++i) {
-            W[i] = other.W[i];
-        }
-        for (size_t i = 0; i < b_numel; ++i) {
-            b[i] = other.b[i];
+    big_affine(const big_affine<T, dim0, dim1, Row>& other) {
+        if (other.borrowed()) {
+            W = other.W;
+            mapping_ = other.mapping_;
+            if (other.owned_) {
+                owned_ = make_aligned<Row>(flip_numel);
+                F = owned_.get();
+                std::copy(other.F, other.F + flip_numel, F);
+            } else {
+                F = other.F;
+            }
+        } else {
+            allocate_();
+            std::copy(other.W, other.W + W_numel, W);
+            std::copy(other.F, other.F + flip_numel, F);
         }
+        std::copy(other.b, other.b + b_numel, b);
     }
 
-    big_affine(big_affine<T, dim0, dim1>&& other) {
-        std::swap(W, other.W);
-        std::swap(b, other.b);
+    big_affine(big_affine<T, dim0, dim1, Row>&& other) {
+        *this = std::move(other);
     }
 
     big_affine() {
-        W = new T[W_numel];
+        allocate_();
     }
 
-    ~big_affine() {
-        if (W != nullptr) {
-            delete[] W;
-        }
+   private:
+    void allocate_() {
+        owned_ = make_aligned<Row>(W_numel + flip_numel);
+        W = owned_.get();
+        F = W + W_numel;
+        mapping_ = weights_mapping{};
     }
 };
 
@@ -0,0 +1,154 @@
+#ifndef SEARCH_TRYHARD_REFRESH_CACHE_HPP
+#define SEARCH_TRYHARD_REFRESH_CACHE_HPP
+
+#include <cstdint>
+#include <libataxx/position.hpp>
+#include <vector>
+#include "nnue_model.hpp"
+
+namespace search {
+
+namespace tryhard {
+
+// Accumulators of recently refreshed positions, keyed by their stones. A refresh starts from the entry
+// differing in the fewest squares instead of the bias, which pays off when consecutive positions are related
+// (analysis, the same game move after move).
+template <typename Eval>
+class RefreshCache {
+   public:
+    static constexpr int num_entries = 4;
+    // Float accumulators pick up rounding error with every diff, so chains of diffs are cut this long
+    static constexpr int max_chain = 32;
+
+    RefreshCache() {
+        evaluators_.reserve(num_entries);
+    }
+
+    // Set the accumulators of evaluator to those of pos
+    void refresh(Eval &evaluator, const libataxx::Position &pos) noexcept {
+        const auto white = pos.white();
+        const auto black = pos.black();
+
+        // Every changed square costs one row per accumulator, every stone one row from the bias. Entries of
+        // another network are never closer. Branch free, as consecutive distances are unpredictable.
+        int best = -1;
+        int best_distance = (white | black).count();
+        for (int i = 0; i < size_; ++i) {
+            const int distance = ((white ^ whites_[i]) | (black ^ blacks_[i])).count() +
+                                 (evaluators_[i].weights_ == evaluator.weights_ ? 0 : 64);
+            const bool closer = distance < best_distance;
+            best = closer ? i : best;
+            best_distance = closer ? distance : best_distance;
+        }
+
+        if (best != -1 && best_distance == 0) {
+            evaluator = evaluators_[best];
+            used_[best] = ++age_;
+            hits_++;
+            return;
+        }
+
+        nnue::feature_delta white_delta;
+        nnue::feature_delta black_delta;
+        int chain = 0;
+        if (best == -1 || chains_[best] >= max_chain) {
+            diff(libataxx::Bitboard{}, libataxx::Bitboard{}, white, black, white_delta, black_delta);
+            evaluator.white.refresh(white_delta);
+            evaluator.black.refresh(black_delta);
+            misses_++;
+        } else {
+            diff(whites_[best], blacks_[best], white, black, white_delta, black_delta);
+            evaluator.white.update(evaluators_[best].white, white_delta);
+            evaluator.black.update(evaluators_[best].black, black_delta);
+            chain = chains_[best] + 1;
+            hits_++;
+        }
+
+        // Replace the least recently used entry once full
+        int slot = size_;
+        if (size_ < num_entries) {
+            evaluators_.push_back(evaluator);
+            size_++;
+        } else {
+            slot = 0;
+            for (int i = 1; i < num_entries; ++i) {
+                slot = used_[i] < used_[slot] ? i : slot;
+            }
+            evaluators_[slot] = evaluator;
+        }
+        whites_[slot] = white;
+        blacks_[slot] = black;
+        chains_[slot] = chain;
+        used_[slot] = ++age_;
+    }
+
+    // Refreshes started from a cached entry, and from the bias
+    [[nodiscard]] std::uint64_t hits() const noexcept {
+        return hits_;
+    }
+
+    [[nodiscard]] std::uint64_t misses() const noexcept {
+        return misses_;
+    }
+
+    void clear() noexcept {
+        evaluators_.clear();
+        size_ = 0;
+    }
+
+    // Features turning the stones (old_white, old_black) into (white, black). A square changing colour is
+    // a single flip row, as in Tryhard::move_delta.
+    static void diff(const libataxx::Bitboard old_white,
+                     const libataxx::Bitboard old_black,
+                     const libataxx::Bitboard white,
+                     const libataxx::Bitboard black,
+                     nnue::feature_delta &white_delta,
+                     nnue::feature_delta &black_delta) noexcept {
+        const auto old_stones = old_white | old_black;
+        const auto stones = white | black;
+
+        for (const auto sq : white & ~old_stones) {
+            white_delta.add(sq.index());
+            black_delta.add(7 * 7 + sq.index());
+        }
+        for (const auto sq : black & ~old_stones) {
+            black_delta.add(sq.index());
+            white_delta.add(7 * 7 + sq.index());
+        }
+        for (const auto sq : old_white & ~stones) {
+            white_delta.remove(sq.index());
+            black_delta.remove(7 * 7 + sq.index());
+        }
+        for (const auto sq : old_black & ~stones) {
+            black_delta.remove(sq.index());
+            white_delta.remove(7 * 7 + sq.index());
+        }
+        for (const auto sq : white & old_black) {
+            white_delta.add(nnue::flip_idx(sq.index()));
+            black_delta.remove(nnue::flip_idx(sq.index()));
+        }
+        for (const auto sq : black & old_white) {
+            black_delta.add(nnue::flip_idx(sq.index()));
+            white_delta.remove(nnue::flip_idx(sq.index()));
+        }
+    }
+
+   private:
+    // Keys are kept apart from the accumulators so the search for the closest entry stays in a few cache lines
+    libataxx::Bitboard whites_[num_entries];
+    libataxx::Bitboard blacks_[num_entries];
+    // Diffs applied since the accumulators were refreshed from the bias
+    int chains_[num_entries] = {};
+    std::uint64_t used_[num_entries] = {};
+    std::vector<Eval> evaluators_;
+    int size_ = 0;
+    std::uint64_t age_ = 0;
+    std::uint64_t hits_ = 0;
+    std::uint64_t misses_ = 0;
+};
+
+}  // namespace tryhard
+
+}  // namespace search
+
+#endif
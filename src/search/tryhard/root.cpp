@@ -11,11 +11,13 @@ namespace tryhard {
 
 constexpr std::array<int, 4> bounds = {50, 200, 800, 10 * mate_score};
 
-void Tryhard::root(const libataxx::Position pos, const Settings &settings) noexcept {
+template <typename Eval>
+void Tryhard<Eval>::root(const libataxx::Position pos, const Settings &settings) noexcept {
     const auto t0 = steady_clock::now();
 
     // Clear
     stats_.clear();
+    tt_.new_search();
     for (int i = 0; i < max_depth + 1; ++i) {
         stack_[i].ply = i;
         stack_[i].pv.clear();
@@ -23,6 +25,7 @@ void Tryhard::root(const libataxx::Position pos, const Settings &settings) noexc
         stack_[i].nullmove = true;
     }
     init_pos(pos);
+    stack_[0].hash = pos.hash();
 
     PV pv;
     const auto start_time = steady_clock::now();
@@ -161,6 +164,24 @@ void Tryhard::root(const libataxx::Position pos, const Settings &settings) noexc
     }
 #endif
 
+    if (stats_.nnue_updates > 0) {
+        const auto skipped = stats_.nnue_updates - stats_.nnue_applied;
+        std::cout << "info string";
+        std::cout << " nnue updates " << stats_.nnue_updates;
+        std::cout << " skipped " << 100 * static_cast<float>(skipped) / stats_.nnue_updates << "%";
+        std::cout << std::endl;
+    }
+
+    if (stats_.eval_probes > 0) {
+        std::cout << "info string";
+        std::cout << " eval probes " << stats_.eval_probes;
+        std::cout << " hits " << 100 * static_cast<float>(stats_.eval_hits) / stats_.eval_probes << "%";
+        if (stats_.lazy_evals > 0) {
+            std::cout << " lazy " << 100 * static_cast<float>(stats_.lazy_evals) / stats_.eval_probes << "%";
+        }
+        std::cout << std::endl;
+    }
+
     const auto t1 = steady_clock::now();
     const auto dt = duration_cast<milliseconds>(t1 - t0);
     std::cout << "info time " << dt.count() << "\n";
@@ -172,6 +193,10 @@ void Tryhard::root(const libataxx::Position pos, const Settings &settings) noexc
     }
 }
 
+#define TRYHARD_ROOT(Eval) template void Tryhard<Eval>::root(const libataxx::Position, const Settings &) noexcept;
+AUTAXX_FOR_EACH_EVAL(TRYHARD_ROOT)
+#undef TRYHARD_ROOT
+
 }  // namespace tryhard
 
 }  // namespace search
@@ -14,7 +14,8 @@ namespace search {
 
 namespace tryhard {
 
-int Tryhard::search(Stack *stack, const libataxx::Position &pos, int alpha, int beta, int depth) {
+template <typename Eval>
+int Tryhard<Eval>::search(Stack *stack, const libataxx::Position &pos, int alpha, int beta, int depth) {
     assert(stack);
     assert(alpha < beta);
 
@@ -27,6 +28,10 @@ int Tryhard::search(Stack *stack, const libataxx::Position &pos, int alpha, int
         return 0;
     }
 
+    // The parent has already started loading the TT bucket and eval cache slot of this hash
+    const auto hash = stack->hash;
+    assert(hash == pos.hash());
+
     // Update seldepth stats
     stats_.seldepth = std::max(stack->ply, stats_.seldepth);
 
@@ -54,7 +59,7 @@ int Tryhard::search(Stack *stack, const libataxx::Position &pos, int alpha, int
 
     // Make sure we stop searching
     if (depth <= 0 || stack->ply >= max_depth) {
-        return eval();
+        return eval(stack, pos, alpha, beta);
     }
 
     const bool root = stack->ply == 0;
@@ -63,8 +68,10 @@ int Tryhard::search(Stack *stack, const libataxx::Position &pos, int alpha, int
     libataxx::Move ttmove;
 
     // Probe transposition table
-    const auto ttentry = tt_.poll(pos.hash());
-    if (ttentry.hash == pos.hash() && pos.legal_move(ttentry.move)) {
+    const auto ttentry = tt_.poll(hash);
+    // An entry whose move isn't legal here was stored for another position, so neither its move nor its eval is used
+    const bool ttusable = ttentry.hash == hash && pos.legal_move(ttentry.move);
+    if (ttusable) {
         ttmove = ttentry.move;
         stats_.tthits++;
 
@@ -97,27 +104,22 @@ int Tryhard::search(Stack *stack, const libataxx::Position &pos, int alpha, int
         }
     }
 
-    const auto static_eval = eval();
+    // A TT hit already knows the static eval, which saves the accumulators and the forward pass
+    const int static_eval = ttusable ? ttentry.eval : eval(stack, pos);
 
     assert(depth > 0);
 
-    // Create backup evaluator
-    auto evaluator = evaluator_;
-
     // Nullmove pruning
     if (!root && stack->nullmove && depth > 2 && phase(pos) < 0.9) {
         auto npos = pos;
         npos.makemove(libataxx::Move::nullmove());
-        update(pos, libataxx::Move::nullmove());
+        prefetch(stack + 1, npos, depth - 3);
+        update(stack, pos, libataxx::Move::nullmove());
 
         (stack + 1)->nullmove = false;
         const int score = -search(stack + 1, npos, -beta, -beta + 1, depth - 3);
         (stack + 1)->nullmove = true;
 
-        // Restore backup evaluator
-        evaluator_ = evaluator;
-        turn_ = !turn_;
-
         if (score >= beta) {
             return score;
         }
@@ -144,23 +146,21 @@ int Tryhard::search(Stack *stack, const libataxx::Position &pos, int alpha, int
 
         auto npos = pos;
         npos.makemove(move);
-        update(pos, move);
+        // The child is first searched this much shallower, which decides whether it reaches the horizon
+        const int r = i == 0 ? 0 : reduction(npos, i, depth, pvnode);
+        prefetch(stack + 1, npos, depth - 1 - r);
+        update(stack, pos, move);
 
         int score = 0;
         if (i == 0) {
             score = -search(stack + 1, npos, -beta, -alpha, depth - 1);
         } else {
-            const int r = reduction(npos, i, depth, pvnode);
             score = -search(stack + 1, npos, -alpha - 1, -alpha, depth - 1 - r);
             if (score > alpha) {
                 score = -search(stack + 1, npos, -beta, -alpha, depth - 1);
             }
         }
 
-        // Restore backup evaluator
-        evaluator_ = evaluator;
-        turn_ = !turn_;
-
         if (score > best_score) {
             best_score = score;
             best_move = move;
@@ -191,9 +191,10 @@ int Tryhard::search(Stack *stack, const libataxx::Position &pos, int alpha, int
 
     // Add to transposition table
     TTEntry nentry;
-    nentry.hash = pos.hash();
+    nentry.hash = hash;
     nentry.move = best_move;
     nentry.score = eval_to_tt(best_score, stack->ply);
+    nentry.eval = static_eval;
     nentry.depth = depth;
     nentry.flag = TTEntry::Flag::Exact;
     if (best_score <= alpha_orig) {
@@ -201,13 +202,17 @@ int Tryhard::search(Stack *stack, const libataxx::Position &pos, int alpha, int
     } else if (best_score >= beta) {
         nentry.flag = TTEntry::Flag::Lower;
     }
-    tt_.add(pos.hash(), nentry);
+    tt_.add(hash, nentry);
 
-    assert(tt_.poll(pos.hash()) == nentry);
+    assert(tt_.poll(hash) == nentry);
 
     return alpha;
 }
 
+#define TRYHARD_SEARCH(Eval) template int Tryhard<Eval>::search(Stack *, const libataxx::Position &, int, int, int);
+AUTAXX_FOR_EACH_EVAL(TRYHARD_SEARCH)
+#undef TRYHARD_SEARCH
+
 }  // namespace tryhard
 
 }  // namespace search
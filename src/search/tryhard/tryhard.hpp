@@ -1,13 +1,20 @@
 #ifndef SEARCH_TRYHARD_HPP
 #define SEARCH_TRYHARD_HPP
 
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
 #include <libataxx/move.hpp>
 #include <libataxx/position.hpp>
+#include <vector>
 #include "../../utils.hpp"
 #include "../pv.hpp"
 #include "../search.hpp"
 #include "../tt.hpp"
+#include "eval_cache.hpp"
 #include "nnue_model.hpp"
+#include "nnue_quantized.hpp"
+#include "refresh_cache.hpp"
 #include "ttentry.hpp"
 
 namespace search {
@@ -37,16 +44,47 @@ constexpr int eval_from_tt(const int eval, const int ply) {
     return eval;
 }
 
+[[nodiscard]] int classical(const libataxx::Position &pos) noexcept;
+
+// Whether a classical score at least margin outside of [alpha, beta] can stand in for the network: the search
+// only needs to know which side of the window such a position falls on. A margin of 0 never cuts.
+[[nodiscard]] constexpr bool lazy_cutoff(const int estimate, const int alpha, const int beta, const int margin) {
+    return margin > 0 && (estimate - margin >= beta || estimate + margin <= alpha);
+}
+
+// Evaluators of the compiled in architectures, see nnue::architectures
+template <std::size_t BaseDim>
+using FloatEval = nnue::eval<float, nnue::architecture<BaseDim>>;
+template <std::size_t BaseDim>
+using QuantizedEval = nnue::basic_quantized_eval<nnue::architecture<BaseDim>>;
+// Float evaluators with 16 bit feature transformer rows, see nnue_half.hpp
+template <std::size_t BaseDim>
+using Bf16Eval = nnue::eval<float, nnue::architecture<BaseDim>, nnue::bf16>;
+template <std::size_t BaseDim>
+using Fp16Eval = nnue::eval<float, nnue::architecture<BaseDim>, nnue::fp16>;
+
+// X(Eval) for every evaluator above at every width of nnue::architectures, for the explicit instantiations
+#define AUTAXX_EVALS_OF_WIDTH(X, dim) X(FloatEval<dim>) X(QuantizedEval<dim>) X(Bf16Eval<dim>) X(Fp16Eval<dim>)
+#define AUTAXX_FOR_EACH_EVAL(X) AUTAXX_FOR_EACH_WIDTH(AUTAXX_EVALS_OF_WIDTH, X)
+
+template <typename Eval>
 class Tryhard : public Search {
    public:
+    using eval_type = Eval;
+    using weights_type = typename Eval::weights_type;
+
     struct Stack {
         int ply;
+        // Of the position at this ply, set as soon as the move leading to it is played
+        std::uint64_t hash;
         PV pv;
         libataxx::Move killer;
         bool nullmove;
     };
 
-    Tryhard(const unsigned int mb, const nnue::weights<float> &weights) : tt_{mb}, evaluator_{&weights}, turn_{false} {
+    // lazy_margin enables lazy evaluation at the horizon, see lazy_cutoff
+    Tryhard(const unsigned int mb, const unsigned int eval_mb, const int lazy_margin, const weights_type &weights)
+        : tt_{mb}, eval_cache_{eval_mb}, lazy_margin_{lazy_margin}, accumulators_(max_depth + 1, Eval{&weights}) {
     }
 
     void go(const libataxx::Position pos, const Settings &settings) override {
@@ -54,6 +92,8 @@ class Tryhard : public Search {
         search_thread_ = std::thread(&Tryhard::root, this, pos, settings);
     }
 
+    // The eval cache is kept: a static eval depends on the position alone, so it never goes stale, and wiping
+    // the cache would cost a pass over all of it on every new game
     void clear() noexcept override {
         tt_.clear();
         for (int i = 0; i < max_depth + 1; ++i) {
@@ -65,149 +105,197 @@ class Tryhard : public Search {
     }
 
     void init_pos(const libataxx::Position &pos) noexcept {
-        evaluator_.white.clear();
-        evaluator_.black.clear();
-
-        for (const auto &sq : pos.white()) {
-            evaluator_.white.insert(sq.index());
-            evaluator_.black.insert(7 * 7 + sq.index());
-        }
-
-        for (const auto &sq : pos.black()) {
-            evaluator_.black.insert(sq.index());
-            evaluator_.white.insert(7 * 7 + sq.index());
-        }
+        refresh_cache_.refresh(accumulators_[0], pos);
+        pending_[0].dirty = false;
+    }
 
-        turn_ = static_cast<bool>(pos.turn());
+    // Record the move leading to the child at stack->ply + 1. Its accumulators are only brought up to
+    // date if the child is evaluated, so nodes returning early (TT cutoffs, game over, stop) never pay for them.
+    void update(const Stack *stack, const libataxx::Position &pos, const libataxx::Move &move) noexcept {
+        stats_.nnue_updates++;
+        pending_[stack->ply + 1] = Pending{move, pos.them(), pos.turn(), true};
     }
 
-    void update(const libataxx::Position &pos, const libataxx::Move &move) {
-        turn_ = !turn_;
+    // A cached score leaves the accumulators of the ply pending, its children catch up from further back if needed
+    [[nodiscard]] int eval(const Stack *stack, const libataxx::Position &pos) noexcept {
+        return eval(stack, pos, -mate_score, mate_score);
+    }
 
-        // Handle nullmove
-        if (move == libataxx::Move::nullmove()) {
-            return;
+    // As above, given the window the score is compared against. The classical score of positions far enough
+    // outside of it is returned instead of the network's, and kept out of the eval cache. stack->hash is the
+    // hash of pos, recorded when the move to it was made.
+    [[nodiscard]] int eval(const Stack *stack,
+                           const libataxx::Position &pos,
+                           const int alpha,
+                           const int beta) noexcept {
+        const auto hash = stack->hash;
+        assert(hash == pos.hash());
+        int score = 0;
+        stats_.eval_probes++;
+        if (eval_cache_.probe(hash, score)) {
+            stats_.eval_hits++;
+            return score;
         }
-
-        const auto to_bb = libataxx::Bitboard{move.to()};
-        const auto from_bb = libataxx::Bitboard{move.from()};
-        const auto them_unset = to_bb.singles() & pos.them();
-        const auto us_set = them_unset | to_bb;
-        const auto us_unset = from_bb & (~to_bb);
-
-        if (pos.turn() == libataxx::Side::White) {
-            for (const auto sq : us_set) {
-                evaluator_.white.insert(sq.index());
-                evaluator_.black.insert(7 * 7 + sq.index());
-            }
-
-            for (const auto sq : us_unset) {
-                evaluator_.white.erase(sq.index());
-                evaluator_.black.erase(7 * 7 + sq.index());
-            }
-
-            for (const auto sq : them_unset) {
-                evaluator_.black.erase(sq.index());
-                evaluator_.white.erase(7 * 7 + sq.index());
-            }
-        } else {
-            for (const auto sq : us_set) {
-                evaluator_.black.insert(sq.index());
-                evaluator_.white.insert(7 * 7 + sq.index());
+        if (lazy_margin_ > 0) {
+            const int estimate = classical(pos);
+            if (lazy_cutoff(estimate, alpha, beta, lazy_margin_)) {
+                stats_.lazy_evals++;
+                return estimate;
             }
+        }
+        materialize(stack->ply);
+        score = accumulators_[stack->ply].evaluate(static_cast<bool>(pos.turn()));
+        eval_cache_.store(hash, score);
+        return score;
+    }
 
-            for (const auto sq : us_unset) {
-                evaluator_.black.erase(sq.index());
-                evaluator_.white.erase(7 * 7 + sq.index());
-            }
+    // Features of every stone on the board, relative to empty accumulators
+    static void position_delta(const libataxx::Position &pos,
+                               nnue::feature_delta &white,
+                               nnue::feature_delta &black) noexcept {
+        for (const auto &sq : pos.white()) {
+            white.add(sq.index());
+            black.add(7 * 7 + sq.index());
+        }
 
-            for (const auto sq : them_unset) {
-                evaluator_.white.erase(sq.index());
-                evaluator_.black.erase(7 * 7 + sq.index());
-            }
+        for (const auto &sq : pos.black()) {
+            black.add(sq.index());
+            white.add(7 * 7 + sq.index());
         }
     }
 
-    void downdate(const libataxx::Position &pos, const libataxx::Move &move) {
-        turn_ = !turn_;
+    // Features changed by playing move in pos. A nullmove changes nothing.
+    static void move_delta(const libataxx::Position &pos,
+                           const libataxx::Move &move,
+                           nnue::feature_delta &white,
+                           nnue::feature_delta &black) noexcept {
+        move_delta(pos.turn(), pos.them(), move, white, black);
+    }
 
-        // Handle nullmove
+    // As above, given only the side to move and the opponent's stones before the move
+    static void move_delta(const libataxx::Side turn,
+                           const libataxx::Bitboard them_bb,
+                           const libataxx::Move &move,
+                           nnue::feature_delta &white,
+                           nnue::feature_delta &black) noexcept {
         if (move == libataxx::Move::nullmove()) {
             return;
         }
 
         const auto to_bb = libataxx::Bitboard{move.to()};
         const auto from_bb = libataxx::Bitboard{move.from()};
-        const auto them_unset = to_bb.singles() & pos.them();
-        const auto us_set = them_unset | to_bb;
+        const auto captured = to_bb.singles() & them_bb;
         const auto us_unset = from_bb & (~to_bb);
 
-        if (pos.turn() == libataxx::Side::White) {
-            for (const auto sq : us_set) {
-                evaluator_.white.erase(sq.index());
-                evaluator_.black.erase(7 * 7 + sq.index());
-            }
+        auto &us = turn == libataxx::Side::White ? white : black;
+        auto &them = turn == libataxx::Side::White ? black : white;
 
-            for (const auto sq : us_unset) {
-                evaluator_.white.insert(sq.index());
-                evaluator_.black.insert(7 * 7 + sq.index());
-            }
+        us.add(move.to().index());
+        them.add(7 * 7 + move.to().index());
 
-            for (const auto sq : them_unset) {
-                evaluator_.black.insert(sq.index());
-                evaluator_.white.insert(7 * 7 + sq.index());
-            }
-        } else {
-            for (const auto sq : us_set) {
-                evaluator_.black.erase(sq.index());
-                evaluator_.white.erase(7 * 7 + sq.index());
-            }
-
-            for (const auto sq : us_unset) {
-                evaluator_.black.insert(sq.index());
-                evaluator_.white.insert(7 * 7 + sq.index());
-            }
+        for (const auto sq : us_unset) {
+            us.remove(sq.index());
+            them.remove(7 * 7 + sq.index());
+        }
 
-            for (const auto sq : them_unset) {
-                evaluator_.white.insert(sq.index());
-                evaluator_.black.insert(7 * 7 + sq.index());
-            }
+        // A captured stone turns from "them" to "us": one flip row, added for us and removed for them
+        for (const auto sq : captured) {
+            us.add(nnue::flip_idx(sq.index()));
+            them.remove(nnue::flip_idx(sq.index()));
         }
     }
 
-    [[nodiscard]] int eval() noexcept {
-        return evaluator_.evaluate(turn_);
+    [[nodiscard]] static int eval(const libataxx::Position &pos, const weights_type &weights) noexcept {
+        auto evaluator = Eval{&weights};
+        refresh(evaluator, pos);
+        const int score = evaluator.evaluate(static_cast<bool>(pos.turn()));
+        return score;
     }
 
-    [[nodiscard]] static int eval(const libataxx::Position &pos, const nnue::weights<float> &weights) noexcept {
-        auto evaluator = nnue::eval<float>{&weights};
+    // As above, starting from the closest position in cache
+    [[nodiscard]] static int eval(const libataxx::Position &pos,
+                                  const weights_type &weights,
+                                  RefreshCache<Eval> &cache) noexcept {
+        auto evaluator = Eval{&weights};
+        cache.refresh(evaluator, pos);
+        return evaluator.evaluate(static_cast<bool>(pos.turn()));
+    }
 
-        for (const auto &sq : pos.white()) {
-            evaluator.white.insert(sq.index());
-            evaluator.black.insert(7 * 7 + sq.index());
+    // Scores of n positions, evaluated together by Eval::evaluate_batch
+    static void eval(const libataxx::Position *positions,
+                     const std::size_t n,
+                     const weights_type &weights,
+                     RefreshCache<Eval> &cache,
+                     int *scores) {
+        std::vector<Eval> evaluators(nnue::eval_batch_size, Eval{&weights});
+        bool povs[nnue::eval_batch_size];
+
+        for (std::size_t start = 0; start < n; start += nnue::eval_batch_size) {
+            const std::size_t m = std::min(nnue::eval_batch_size, n - start);
+            for (std::size_t k = 0; k < m; ++k) {
+                cache.refresh(evaluators[k], positions[start + k]);
+                povs[k] = static_cast<bool>(positions[start + k].turn());
+            }
+            Eval::evaluate_batch(evaluators.data(), povs, scores + start, m);
         }
+    }
 
-        for (const auto &sq : pos.black()) {
-            evaluator.black.insert(sq.index());
-            evaluator.white.insert(7 * 7 + sq.index());
+   private:
+    // The move leading to a ply, kept until the accumulators of that ply are needed
+    struct Pending {
+        libataxx::Move move;
+        libataxx::Bitboard them;
+        libataxx::Side turn;
+        bool dirty;
+    };
+
+    // Catch the accumulators at ply up from the nearest clean ancestor
+    void materialize(const int ply) noexcept {
+        int clean = ply;
+        while (pending_[clean].dirty) {
+            clean--;
         }
 
-        const int score = evaluator.evaluate(static_cast<bool>(pos.turn()));
-        return score;
+        for (int i = clean + 1; i <= ply; ++i) {
+            nnue::feature_delta white;
+            nnue::feature_delta black;
+            move_delta(pending_[i].turn, pending_[i].them, pending_[i].move, white, black);
+            accumulators_[i].white.update(accumulators_[i - 1].white, white);
+            accumulators_[i].black.update(accumulators_[i - 1].black, black);
+            pending_[i].dirty = false;
+            stats_.nnue_applied++;
+        }
     }
 
-    [[nodiscard]] static int classical(const libataxx::Position &pos) noexcept;
+    static void refresh(Eval &evaluator, const libataxx::Position &pos) noexcept {
+        nnue::feature_delta white;
+        nnue::feature_delta black;
+        position_delta(pos, white, black);
+        evaluator.white.refresh(white);
+        evaluator.black.refresh(black);
+    }
 
-    nnue::eval<float> evaluator_;
-    bool turn_;
+    // Record the hash of the child at stack and start loading what its search reads first, while the
+    // parent still has the move to finish. Children at the horizon only evaluate, and leave the TT alone.
+    void prefetch(Stack *stack, const libataxx::Position &npos, const int depth) noexcept {
+        stack->hash = npos.hash();
+        if (depth > 0) {
+            tt_.prefetch(stack->hash);
+        }
+        eval_cache_.prefetch(stack->hash);
+    }
 
-   private:
     void root(const libataxx::Position pos, const Settings &settings) noexcept;
 
     [[nodiscard]] int search(Stack *stack, const libataxx::Position &pos, int alpha, int beta, int depth);
 
     Stack stack_[max_depth + 1];
     TT<TTEntry> tt_;
+    EvalCache eval_cache_;
+    int lazy_margin_;
+    std::vector<Eval> accumulators_;
+    Pending pending_[max_depth + 1];
+    RefreshCache<Eval> refresh_cache_;
 };
 
 }  // namespace tryhard
@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cstdint>
 #include <libataxx/move.hpp>
+#include "../tt.hpp"
 
 struct TTEntry {
     enum class Flag : std::uint8_t
@@ -14,16 +15,29 @@ struct TTEntry {
     };
 
     [[nodiscard]] constexpr bool operator==(const TTEntry &rhs) const noexcept {
-        return hash == rhs.hash && move == rhs.move && score == rhs.score && depth == rhs.depth && flag == rhs.flag;
+        return hash == rhs.hash && move == rhs.move && score == rhs.score && eval == rhs.eval && depth == rhs.depth &&
+               flag == rhs.flag;
     }
 
     std::uint64_t hash;
     libataxx::Move move;
     std::int16_t score;
+    // Static evaluation of the position, every stored node has computed one. Fills what used to be padding.
+    std::int16_t eval;
     std::uint8_t depth;
     Flag flag;
 };
 
 static_assert(sizeof(TTEntry) == 16);
 
+// Deeper entries are worth more, and an exact score more than a bound from the same depth
+template <>
+struct search::tt_traits<TTEntry> {
+    [[nodiscard]] static constexpr int worth(const TTEntry &t) noexcept {
+        return 2 * t.depth + (t.flag == TTEntry::Flag::Exact ? 1 : 0);
+    }
+
+    static constexpr int age_weight = 8;
+};
+
 #endif
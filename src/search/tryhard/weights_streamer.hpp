@@ -1,41 +1,199 @@
 #pragma once
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <algorithm>
-#include <array>
 #include <cstdint>
 #include <cstring>
-#include <fstream>
+#include <memory>
+#include <new>
 #include <string>
+#include <utility>
+#include "nnue_format.hpp"
 
 namespace nnue {
 
-template <typename T>
-struct weights_streamer {
-    using signature_type = std::uint32_t;
+// A weights file held in memory as a whole: mapped read-only where possible, otherwise read in one go.
+// Copies of the handle share the same bytes, which stay valid until the last copy is gone.
+struct weights_mapping {
+    std::shared_ptr<const char> data_{};
+    size_t size_{0};
+    bool mapped_{false};
+
+    const char* data() const {
+        return data_.get();
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool mapped() const {
+        return mapped_;
+    }
+
+    weights_mapping() = default;
+
+    // Bytes that outlive every user, e.g. a network compiled into the binary
+    weights_mapping(const char* data, const size_t size)
+        : data_{std::shared_ptr<const char>(data, [](const char*) {})}, size_{size} {
+    }
+
+    // Bytes kept alive by owner, e.g. part of a larger mapping
+    weights_mapping(std::shared_ptr<const char> owner, const size_t size, const bool mapped)
+        : data_{std::move(owner)}, size_{size}, mapped_{mapped} {
+    }
+
+    weights_mapping(const std::string& name) {
+        const int fd = ::open(name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            return;
+        }
+
+        // Only a regular file has a size to go by, and can be mapped
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            const size_t length = static_cast<size_t>(st.st_size);
+            void* addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                data_ = std::shared_ptr<const char>(static_cast<const char*>(addr), [length](const char* p) {
+                    ::munmap(const_cast<char*>(p), length);
+                });
+                size_ = length;
+                mapped_ = true;
+                ::close(fd);
+                return;
+            }
+        }
+
+        // Otherwise (e.g. a pipe) read up to the end, into memory aligned like a mapping
+        std::string bytes;
+        char chunk[1 << 16];
+        ssize_t n = 0;
+        while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+            bytes.append(chunk, static_cast<size_t>(n));
+        }
+        ::close(fd);
+        if (bytes.empty()) {
+            return;
+        }
+        std::shared_ptr<char> buffer(static_cast<char*>(::operator new[](bytes.size(), std::align_val_t{cache_line})),
+                                     [](char* p) { ::operator delete[](p, std::align_val_t{cache_line}); });
+        std::memcpy(buffer.get(), bytes.data(), bytes.size());
+        size_ = bytes.size();
+        data_ = buffer;
+    }
+};
 
-    signature_type signature_{0};
-    std::fstream file;
+// Reads the parameters of a network in order, after checking the file with open()
+struct weights_streamer {
+    std::string name_;
+    weights_mapping mapping_;
+    size_t offset_{0};
 
-    weights_streamer<T>& stream(T* dst, const size_t request) {
-        constexpr size_t signature_bytes = std::min(sizeof(signature_type), sizeof(T));
-        std::array<char, sizeof(T)> single_element{};
-        for (size_t i(0); i < request; ++i) {
-            file.read(single_element.data(), single_element.size());
-            std::memcpy(dst + i, single_element.data(), single_element.size());
+    // Validate the file and move to the start of its parameters, see read_header
+    file_header open(const element_type element,
+                     const file_dims& dims,
+                     const size_t payload_bytes,
+                     const size_t legacy_bytes) {
+        const auto header =
+            read_header(name_, mapping_.data(), mapping_.size(), element, dims, payload_bytes, legacy_bytes);
+        offset_ = header.version == 0 ? 0 : sizeof(file_header);
+        return header;
+    }
 
-            signature_type x{};
-            std::memcpy(&x, single_element.data(), signature_bytes);
-            signature_ ^= x;
+    // Copy the next request elements into dst. Elements missing from a short file read as zero.
+    template <typename U>
+    weights_streamer& stream(U* dst, const size_t request) {
+        const size_t available = std::min(request, remaining<U>());
+        if (available > 0) {
+            std::memcpy(dst, mapping_.data() + offset_, available * sizeof(U));
+            offset_ += available * sizeof(U);
         }
+        std::fill(dst + available, dst + request, U{});
         return *this;
     }
 
-    signature_type signature() const {
-        return signature_;
+    // The next request elements in place, or nullptr if they are missing or misaligned for U.
+    // The pointer stays valid as long as a copy of mapping() does.
+    template <typename U>
+    const U* view(const size_t request) {
+        const char* src = mapping_.data() + offset_;
+        if (request > remaining<U>() || reinterpret_cast<std::uintptr_t>(src) % alignof(U) != 0) {
+            return nullptr;
+        }
+        offset_ += request * sizeof(U);
+        return reinterpret_cast<const U*>(src);
+    }
+
+    const weights_mapping& mapping() const {
+        return mapping_;
+    }
+
+    weights_streamer(const std::string& name) : name_{name}, mapping_(name) {
+    }
+
+    weights_streamer(const std::string& name, const weights_mapping& mapping) : name_{name}, mapping_{mapping} {
     }
 
-    weights_streamer(const std::string& name) : file(name, std::ios_base::in | std::ios_base::binary) {
+   private:
+    template <typename U>
+    size_t remaining() const {
+        return (mapping_.size() - offset_) / sizeof(U);
     }
 };
 
+// Element type of a network file, legacy files hold floats. Throws load_error if it can't be read.
+inline element_type file_element(const std::string& name, const weights_mapping& mapping) {
+    if (mapping.data() == nullptr) {
+        throw load_error("nnue " + name + ": can't read the file");
+    }
+    if (!has_header(mapping.data(), mapping.size())) {
+        return element_type::f32;
+    }
+    file_header header{};
+    std::memcpy(&header, mapping.data(), sizeof(file_header));
+    return header.element;
+}
+
+inline element_type file_element(const std::string& path) {
+    return file_element(path, weights_mapping(path));
+}
+
+// xxh64 of the parameters of a network file, as given by its header. Throws load_error if it can't be read.
+inline std::uint64_t file_signature(const std::string& name, const weights_mapping& mapping) {
+    if (mapping.data() == nullptr) {
+        throw load_error("nnue " + name + ": can't read the file");
+    }
+    if (!has_header(mapping.data(), mapping.size())) {
+        return xxh64::hash(mapping.data(), mapping.size());
+    }
+    file_header header{};
+    std::memcpy(&header, mapping.data(), sizeof(file_header));
+    return header.payload_hash;
+}
+
+// Layer dimensions of a network file, legacy files having those of legacy_dims. Throws load_error if it
+// can't be read.
+inline file_dims file_dimensions(const std::string& name,
+                                 const weights_mapping& mapping,
+                                 const file_dims& legacy_dims) {
+    if (mapping.data() == nullptr) {
+        throw load_error("nnue " + name + ": can't read the file");
+    }
+    if (!has_header(mapping.data(), mapping.size())) {
+        return legacy_dims;
+    }
+    file_header header{};
+    std::memcpy(&header, mapping.data(), sizeof(file_header));
+    return header.dims;
+}
+
 }  // namespace nnue
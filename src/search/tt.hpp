@@ -1,58 +1,190 @@
 #ifndef SEARCH_TT_HPP
 #define SEARCH_TT_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <limits>
+#include <memory>
+#include <type_traits>
 
 namespace search {
 
+// How TT<T> ranks entries when a bucket is full. T needs a hash, 0 meaning empty, and by default a depth.
+// Specialize for entries that know more, e.g. their bound type.
+template <class T>
+struct tt_traits {
+    // Worth of keeping an entry of the current search, the least worthy entry of a full bucket is replaced
+    [[nodiscard]] static constexpr int worth(const T &t) noexcept {
+        return t.depth;
+    }
+
+    // Worth lost by an entry for each search since it was stored
+    static constexpr int age_weight = 4;
+};
+
+// Transposition table of cache line sized buckets. A position may sit in any entry of the bucket its hash picks,
+// so a deep entry isn't lost to the next shallow one that happens to share its bucket.
+//
+// Any number of threads may poll and add at once without locks. An entry is kept as 64 bit words, the first of
+// which is its hash xor all the others. A read torn by a concurrent write doesn't xor back to the hash it was
+// looked up by, so it is a miss rather than another position's move and score.
 template <class T>
 class TT {
+    static_assert(std::is_trivially_copyable_v<T>, "entries are copied word by word");
+    static_assert(sizeof(T) % sizeof(std::uint64_t) == 0, "entries are copied word by word");
+    static_assert(offsetof(T, hash) == 0, "the hash is the word keying the others");
+
    public:
-    TT(unsigned int mb) : filled_{0} {
-        if (mb < 0) {
+    static constexpr std::size_t bucket_bytes = 64;
+    static constexpr std::size_t entry_words = sizeof(T) / sizeof(std::uint64_t);
+    // Each entry comes with its generation
+    static constexpr std::size_t bucket_entries =
+        std::max<std::size_t>(1, bucket_bytes / (sizeof(T) + sizeof(std::uint16_t)));
+    // Entries read by hashfull()
+    static constexpr std::size_t hashfull_sample = 1000;
+
+    TT(unsigned int mb) : generation_{0}, cleared_{0} {
+        if (mb < 1) {
             mb = 1;
         }
-        max_entries_ = (mb * 1024 * 1024) / sizeof(T);
-        entries_ = new T[max_entries_];
-    }
-
-    ~TT() {
-        delete entries_;
+        num_buckets_ = (std::size_t{mb} * 1024 * 1024) / sizeof(Bucket);
+        buckets_ = std::unique_ptr<Bucket[]>(new Bucket[num_buckets_]);
+        wipe();
     }
 
+    // The entry of hash, or an empty one
     [[nodiscard]] T poll(const std::uint64_t hash) const noexcept {
-        const auto idx = index(hash);
-        return entries_[idx];
+        const auto &bucket = buckets_[index(hash)];
+        for (std::size_t i = 0; i < bucket_entries; ++i) {
+            const T entry = load(bucket, i);
+            if (entry.hash == hash && live(bucket.generations[i].load(std::memory_order_relaxed))) {
+                return entry;
+            }
+        }
+        return T{};
     }
 
+    // Store t over the entry of the same position, an empty entry, or else the least worthy one of the bucket.
+    // The whole bucket is looked through for the position first, so it never ends up in two entries.
     void add(const std::uint64_t hash, const T &t) noexcept {
-        const auto idx = index(hash);
-        filled_ += (entries_[idx].hash == 0 ? 1 : 0);
-        entries_[idx] = t;
+        auto &bucket = buckets_[index(hash)];
+        std::size_t victim = 0;
+        int victim_worth = std::numeric_limits<int>::max();
+        for (std::size_t i = 0; i < bucket_entries; ++i) {
+            const T entry = load(bucket, i);
+            if (entry.hash == hash) {
+                victim = i;
+                break;
+            }
+            const auto generation = bucket.generations[i].load(std::memory_order_relaxed);
+            // Empty and stale entries are worth less than any other
+            const int worth = entry.hash == 0 || !live(generation)
+                                  ? std::numeric_limits<int>::min()
+                                  : tt_traits<T>::worth(entry) - tt_traits<T>::age_weight * age_of(generation);
+            if (worth < victim_worth) {
+                victim = i;
+                victim_worth = worth;
+            }
+        }
+
+        std::uint64_t words[entry_words];
+        std::memcpy(words, &t, sizeof(T));
+        for (std::size_t w = 1; w < entry_words; ++w) {
+            words[0] ^= words[w];
+        }
+        for (std::size_t w = 0; w < entry_words; ++w) {
+            bucket.words[victim][w].store(words[w], std::memory_order_relaxed);
+        }
+        bucket.generations[victim].store(generation_, std::memory_order_relaxed);
+    }
+
+    // Start loading the bucket of hash, so a poll or add shortly after doesn't wait on memory
+    void prefetch(const std::uint64_t hash) const noexcept {
+        __builtin_prefetch(&buckets_[index(hash)]);
+    }
+
+    // Entries stored from now on are younger than those stored before. Generations are 16 bits and count from
+    // the last wipe, so when they run out the table is wiped for real rather than letting old entries pass for
+    // new ones.
+    void new_search() noexcept {
+        if (++generation_ == 0) {
+            wipe();
+            cleared_ = 0;
+        }
     }
 
     [[nodiscard]] std::size_t size() const noexcept {
-        return max_entries_;
+        return num_buckets_ * bucket_entries;
     }
 
+    // Empty the table in constant time: entries of earlier generations are no longer found, and are replaced
+    // before any other
     void clear() noexcept {
-        filled_ = 0;
-        std::memset(entries_, 0, max_entries_ * sizeof(T));
+        new_search();
+        cleared_ = generation_;
     }
 
+    // Permille of entries in use, estimated from the first buckets. Hashes spread evenly over the table, and
+    // reading a sample saves the searching threads from sharing a counter of their own.
     [[nodiscard]] int hashfull() const noexcept {
-        return 1000 * (static_cast<double>(filled_) / max_entries_);
+        const std::size_t n = std::min(num_buckets_, (hashfull_sample + bucket_entries - 1) / bucket_entries);
+        std::size_t used = 0;
+        for (std::size_t b = 0; b < n; ++b) {
+            for (std::size_t i = 0; i < bucket_entries; ++i) {
+                used += load(buckets_[b], i).hash != 0 &&
+                        live(buckets_[b].generations[i].load(std::memory_order_relaxed));
+            }
+        }
+        return 1000 * (static_cast<double>(used) / (n * bucket_entries));
     }
 
    private:
+    struct alignas(bucket_bytes) Bucket {
+        std::atomic<std::uint64_t> words[bucket_entries][entry_words];
+        std::atomic<std::uint16_t> generations[bucket_entries];
+    };
+
+    // Entry i of bucket, whose hash is 0 if empty and garbage if torn
+    [[nodiscard]] static T load(const Bucket &bucket, const std::size_t i) noexcept {
+        std::uint64_t words[entry_words];
+        for (std::size_t w = 0; w < entry_words; ++w) {
+            words[w] = bucket.words[i][w].load(std::memory_order_relaxed);
+        }
+        for (std::size_t w = 1; w < entry_words; ++w) {
+            words[0] ^= words[w];
+        }
+        T t;
+        std::memcpy(&t, words, sizeof(T));
+        return t;
+    }
+
+    // Empty every entry, unlike clear() this touches the whole table
+    void wipe() noexcept {
+        std::memset(static_cast<void *>(buckets_.get()), 0, num_buckets_ * sizeof(Bucket));
+    }
+
+    // Searches since an entry of generation was stored
+    [[nodiscard]] int age_of(const std::uint16_t generation) const noexcept {
+        return generation_ - generation;
+    }
+
+    // Whether an entry of generation was stored since the last clear
+    [[nodiscard]] bool live(const std::uint16_t generation) const noexcept {
+        return generation >= cleared_;
+    }
+
+    // Multiply-shift: the upper bits of hash scaled to the number of buckets, which needn't be a power of two
     [[nodiscard]] std::size_t index(const std::uint64_t hash) const noexcept {
-        return hash % max_entries_;
+        return static_cast<std::size_t>((static_cast<unsigned __int128>(hash) * num_buckets_) >> 64);
     }
 
-    std::size_t max_entries_;
-    std::size_t filled_;
-    T *entries_;
+    std::size_t num_buckets_;
+    std::uint16_t generation_;
+    std::uint16_t cleared_;
+    std::unique_ptr<Bucket[]> buckets_;
 };
 
 }  // namespace search
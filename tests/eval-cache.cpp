@@ -0,0 +1,41 @@
+#include <catch2/catch.hpp>
+#include <cstdint>
+#include <libataxx/position.hpp>
+#include <string>
+#include "../src/search/tryhard/eval_cache.hpp"
+
+TEST_CASE("EvalCache -- Scores come back for their own position only") {
+    search::tryhard::EvalCache cache{1};
+    const libataxx::Position pos{"x5o/7/2-1-2/7/2-1-2/7/o5x x 0 1"};
+    auto other = pos;
+    other.makemove(libataxx::Move::nullmove());
+
+    int score = 0;
+    REQUIRE(!cache.probe(pos.hash(), score));
+
+    for (const int stored : {0, 1, -1, 1234, -32768, 32767}) {
+        cache.store(pos.hash(), stored);
+        REQUIRE(cache.probe(pos.hash(), score));
+        REQUIRE(score == stored);
+    }
+
+    // Side to move is part of the key, and a colliding hash with other upper bits misses
+    REQUIRE(!cache.probe(other.hash(), score));
+    REQUIRE(!cache.probe(pos.hash() ^ (std::uint64_t{1} << 63), score));
+
+    // Scores that don't fit are left out
+    cache.clear();
+    cache.store(pos.hash(), 40000);
+    REQUIRE(!cache.probe(pos.hash(), score));
+}
+
+TEST_CASE("EvalCache -- A size of zero disables the cache") {
+    search::tryhard::EvalCache cache{0};
+    REQUIRE(!cache.enabled());
+    cache.store(1234, 5);
+    int score = 0;
+    REQUIRE(!cache.probe(1234, score));
+
+    cache.resize(1);
+    REQUIRE(cache.size() == 1024 * 1024 / sizeof(std::uint64_t));
+}
@@ -1,5 +1,8 @@
 #include <catch2/catch.hpp>
 #include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
 #include <libataxx/move.hpp>
 #include <libataxx/position.hpp>
 #include <string>
@@ -55,3 +58,170 @@ TEST_CASE("hashtable") {
         }
     }
 }
+
+TEST_CASE("hashtable -- Deep entries survive shallow ones in their bucket") {
+    search::TT<Entry> small{1};
+    // Hashes differing in their low bits only share a bucket
+    const std::uint64_t base = 0x9E3779B97F4A7C15ULL & ~std::uint64_t{0xFFFF};
+
+    small.add(base | 1, Entry{base | 1, 100, 20});
+    for (std::uint64_t i = 2; i < 200; ++i) {
+        small.add(base | i, Entry{base | i, i, 1});
+        REQUIRE(small.poll(base | 1).nodes == 100);
+    }
+
+    // The same position is overwritten in place
+    small.add(base | 1, Entry{base | 1, 101, 2});
+    REQUIRE(small.poll(base | 1).nodes == 101);
+    REQUIRE(small.poll(base | 1).depth == 2);
+
+    // Until enough searches have gone by
+    small.add(base | 1, Entry{base | 1, 100, 20});
+    for (int i = 0; i < 10; ++i) {
+        small.new_search();
+    }
+    for (std::uint64_t i = 2; i < 200; ++i) {
+        small.add(base | i, Entry{base | i, i, 1});
+    }
+    REQUIRE(small.poll(base | 1).hash == 0);
+}
+
+TEST_CASE("hashtable -- Clearing bumps the generation instead of wiping the table") {
+    search::TT<Entry> small{1};
+    for (std::uint64_t i = 1; i <= 1000; ++i) {
+        small.add(i * 0x9E3779B97F4A7C15ULL, Entry{i * 0x9E3779B97F4A7C15ULL, i, 5});
+    }
+    REQUIRE(small.hashfull() > 0);
+    REQUIRE(small.poll(0x9E3779B97F4A7C15ULL).nodes == 1);
+
+    small.clear();
+    REQUIRE(small.hashfull() == 0);
+    for (std::uint64_t i = 1; i <= 1000; ++i) {
+        REQUIRE(small.poll(i * 0x9E3779B97F4A7C15ULL).hash == 0);
+    }
+
+    // Stale entries are taken like empty ones, whatever their depth
+    const std::uint64_t hash = 7 * 0x9E3779B97F4A7C15ULL;
+    small.add(hash, Entry{hash, 42, 1});
+    REQUIRE(small.poll(hash).nodes == 42);
+
+    // Searches within a game keep their entries
+    small.new_search();
+    small.new_search();
+    REQUIRE(small.poll(hash).nodes == 42);
+}
+
+TEST_CASE("hashtable -- Entries from before a clear stay gone when the generation wraps") {
+    search::TT<Entry> small{1};
+    for (std::uint64_t i = 1; i <= 1000; ++i) {
+        small.add(i * 0x9E3779B97F4A7C15ULL, Entry{i * 0x9E3779B97F4A7C15ULL, i, 5});
+    }
+    small.new_search();
+    small.clear();
+
+    const std::uint64_t hash = 0x9E3779B97F4A7C15ULL + 1;
+    small.add(hash, Entry{hash, 42, 1});
+    for (int i = 0; i < 1 << 16; ++i) {
+        small.new_search();
+        for (const std::uint64_t j : {1, 2, 500, 1000}) {
+            REQUIRE(small.poll(j * 0x9E3779B97F4A7C15ULL).hash == 0);
+        }
+    }
+    REQUIRE(small.hashfull() == 0);
+
+    // The table works as usual after wiping itself
+    small.add(hash, Entry{hash, 43, 1});
+    REQUIRE(small.poll(hash).nodes == 43);
+}
+
+TEST_CASE("hashtable -- A position is kept in one entry of its bucket") {
+    search::TT<Entry> small{1};
+    const std::uint64_t base = 0x9E3779B97F4A7C15ULL & ~std::uint64_t{0xFFFF};
+    const std::uint64_t other = base | 1;
+    const std::uint64_t hash = base | 2;
+
+    // An entry can go stale before one further along its bucket that is stored again after a clear
+    small.add(other, Entry{other, 0, 1});
+    small.add(hash, Entry{hash, 1, 5});
+    small.clear();
+    small.add(hash, Entry{hash, 1, 5});
+    REQUIRE(small.poll(other).hash == 0);
+    REQUIRE(small.poll(hash).nodes == 1);
+
+    // Stored over its own entry rather than the stale one, so replacing a neighbour can't bring back the old one
+    small.add(hash, Entry{hash, 2, 0});
+    const std::uint64_t deep = base | 3;
+    small.add(deep, Entry{deep, 3, 30});
+    REQUIRE(small.poll(hash).nodes == 2);
+    REQUIRE(small.poll(deep).nodes == 3);
+}
+
+TEST_CASE("hashtable -- hashfull samples the table") {
+    search::TT<Entry> small{1};
+    std::mt19937_64 gen{3};
+    REQUIRE(small.hashfull() == 0);
+
+    for (std::size_t i = 0; i < small.size() / 4; ++i) {
+        const auto hash = gen() | 1;
+        small.add(hash, Entry{hash, i, 1});
+    }
+    REQUIRE(small.hashfull() > 150);
+    REQUIRE(small.hashfull() < 300);
+
+    for (std::size_t i = 0; i < 4 * small.size(); ++i) {
+        const auto hash = gen() | 1;
+        small.add(hash, Entry{hash, i, 1});
+    }
+    REQUIRE(small.hashfull() > 950);
+
+    small.clear();
+    REQUIRE(small.hashfull() == 0);
+}
+
+// Fields of the entry of hash, so any mix of two entries is recognised
+Entry expected_entry(const std::uint64_t hash) {
+    return Entry{hash, hash * 0x2545F4914F6CDD1DULL, static_cast<std::uint8_t>(hash >> 56)};
+}
+
+TEST_CASE("hashtable -- Concurrent writers never leave a torn entry behind a matching hash") {
+    search::TT<Entry> small{1};
+    constexpr int num_threads = 4;
+    constexpr int ops = 200000;
+    // Few distinct hashes, so threads keep writing over each other's entries
+    std::vector<std::uint64_t> hashes(4096);
+    std::mt19937_64 gen{9};
+    for (auto &hash : hashes) {
+        hash = gen() | 1;
+    }
+
+    std::vector<std::thread> threads;
+    std::vector<int> torn(num_threads, 0);
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 local{static_cast<unsigned>(t)};
+            for (int i = 0; i < ops; ++i) {
+                const auto hash = hashes[local() % hashes.size()];
+                if (local() % 2 == 0) {
+                    small.add(hash, expected_entry(hash));
+                } else {
+                    const auto entry = small.poll(hash);
+                    const auto expected = expected_entry(hash);
+                    if (entry.hash == hash && (entry.nodes != expected.nodes || entry.depth != expected.depth)) {
+                        torn[t]++;
+                    }
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (int t = 0; t < num_threads; ++t) {
+        REQUIRE(torn[t] == 0);
+    }
+    for (const auto hash : hashes) {
+        const auto entry = small.poll(hash);
+        REQUIRE((entry.hash == 0 || entry.nodes == expected_entry(hash).nodes));
+    }
+}
@@ -0,0 +1,68 @@
+#include <catch2/catch.hpp>
+#include <libataxx/move.hpp>
+#include <libataxx/position.hpp>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/search/mcts/nnue.hpp"
+#include "../src/search/mcts/node.hpp"
+#include "../src/search/tryhard/nnue_model.hpp"
+#include "../src/search/tryhard/nnue_quantized.hpp"
+#include "nnue-random.hpp"
+
+// Walk random paths down a growing tree, as the tree policy does, and score each leaf with accumulators kept
+// from the previous path and with accumulators updated from the root
+template <typename Eval>
+void check_paths(const typename Eval::weights_type &weights) {
+    const std::string fens[] = {
+        "startpos",
+        "x5o/7/2-1-2/7/2-1-2/7/o5x x 0 1",
+        "x5o/1xx4/2oxo2/2xox2/3o3/7/o5x x 0 1",
+    };
+
+    std::mt19937 gen{5};
+    for (const auto &fen : fens) {
+        const libataxx::Position root_pos{fen};
+        search::mcts::Node root{root_pos};
+        search::mcts::NnueLeaf<Eval> leaf{weights};
+        leaf.set_root(root_pos);
+        int total_plies = 0;
+
+        for (int playout = 0; playout < 300; ++playout) {
+            search::mcts::NnueLeaf<Eval> fresh{weights};
+            fresh.set_root(root_pos);
+
+            auto pos = root_pos;
+            search::mcts::Node *n = &root;
+            int ply = 0;
+            const int max_ply = std::uniform_int_distribution<int>{0, 12}(gen);
+            while (!n->terminal() && ply < max_ply) {
+                search::mcts::Node *child = nullptr;
+                if (n->expandable() && (!n->expanded() || gen() % 2 == 0)) {
+                    child = n->expand(pos);
+                } else {
+                    child = n->child(gen() % n->num_children());
+                }
+                ++ply;
+                leaf.descend(ply, child, pos, child->move());
+                fresh.descend(ply, child, pos, child->move());
+                pos.makemove(child->move());
+                n = child;
+            }
+
+            total_plies += ply;
+            const int score = leaf.evaluate(ply, pos);
+            REQUIRE(score == fresh.evaluate(ply, pos));
+            REQUIRE(std::abs(score - search::tryhard::Tryhard<Eval>::eval(pos, weights)) <= 1);
+        }
+
+        // Paths share their first plies with the one before
+        REQUIRE(leaf.updates() < static_cast<std::uint64_t>(total_plies));
+    }
+}
+
+TEST_CASE("mcts::NnueLeaf -- Leaves reuse the accumulators of the previous path") {
+    const auto weights = random_weights();
+    check_paths<nnue::eval<float>>(weights);
+    check_paths<nnue::quantized_eval>(nnue::quantized_weights{}.quantize(weights));
+}
@@ -0,0 +1,395 @@
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <libataxx/position.hpp>
+#include <string>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include "../src/search/tryhard/nnue_model.hpp"
+#include "../src/search/tryhard/nnue_quantized.hpp"
+#include "../src/search/tryhard/nnue_shared.hpp"
+#include "../src/search/tryhard/tryhard.hpp"
+#include "nnue-random.hpp"
+
+using FloatTryhard = search::tryhard::Tryhard<nnue::eval<float>>;
+using QuantizedTryhard = search::tryhard::Tryhard<nnue::quantized_eval>;
+using Bf16Tryhard = search::tryhard::Tryhard<search::tryhard::Bf16Eval<32>>;
+using Fp16Tryhard = search::tryhard::Tryhard<search::tryhard::Fp16Eval<32>>;
+
+// Write the parameters in the order weights<float>::load reads them, stopping after max_bytes
+void write_raw(const nnue::weights<float> &weights, const std::string &path, const std::size_t max_bytes) {
+    std::string bytes;
+    const auto append = [&bytes](const float *data, const std::size_t numel) {
+        bytes.append(reinterpret_cast<const char *>(data), numel * sizeof(float));
+    };
+    append(weights.w.W, weights.w.W_numel);
+    append(weights.w.b, weights.w.b_numel);
+    append(weights.b.W, weights.b.W_numel);
+    append(weights.b.b, weights.b.b_numel);
+    append(weights.fc0.W, weights.fc0.W_numel);
+    append(weights.fc0.b, weights.fc0.b_numel);
+    append(weights.fc1.W, weights.fc1.W_numel);
+    append(weights.fc1.b, weights.fc1.b_numel);
+    append(weights.fc2.W, weights.fc2.W_numel);
+    append(weights.fc2.b, weights.fc2.b_numel);
+    bytes.resize(std::min(bytes.size(), max_bytes));
+    std::ofstream(path, std::ios::binary).write(bytes.data(), bytes.size());
+}
+
+TEST_CASE("nnue::weights -- Load from a mapped file") {
+    const auto expected = random_weights();
+    const std::string path = "nnue-load-test.bin";
+    write_raw(expected, path, sizeof(float) * expected.num_parameters());
+
+    auto loaded = nnue::weights<float>{}.load(path);
+    std::remove(path.c_str());
+
+    // The feature transformers point into the file, which outlives the copy made above
+    REQUIRE(loaded.w.borrowed());
+    REQUIRE(loaded.b.borrowed());
+    for (std::size_t i = 0; i < expected.w.W_numel; ++i) {
+        REQUIRE(loaded.w.W[i] == expected.w.W[i]);
+        REQUIRE(loaded.b.W[i] == expected.b.W[i]);
+    }
+    for (std::size_t i = 0; i < expected.fc0.W_numel; ++i) {
+        REQUIRE(loaded.fc0.W[i] == expected.fc0.W[i]);
+    }
+
+    for (const auto &fen : {"startpos", "x5o/1xx4/2oxo2/2xox2/3o3/7/o5x x 0 1"}) {
+        const libataxx::Position pos{fen};
+        REQUIRE(FloatTryhard::eval(pos, loaded) == FloatTryhard::eval(pos, expected));
+    }
+}
+
+TEST_CASE("nnue::weights -- Legacy files must have the exact size") {
+    const auto expected = random_weights();
+    const std::string path = "nnue-load-short.bin";
+    write_raw(expected, path, sizeof(float) * (expected.num_parameters() - 1));
+
+    REQUIRE_THROWS_AS(nnue::weights<float>{}.load(path), nnue::load_error);
+    std::remove(path.c_str());
+    REQUIRE_THROWS_AS(nnue::weights<float>{}.load(path), nnue::load_error);
+}
+
+TEST_CASE("nnue::xxh64 -- Reference values") {
+    const std::string abc = "abc";
+    const std::string spam = "Nobody inspects the spammish repetition";
+    REQUIRE(nnue::xxh64::hash("", 0) == 0xEF46DB3751D8E999ULL);
+    REQUIRE(nnue::xxh64::hash(abc.data(), abc.size()) == 0x44BC2CF5AD770999ULL);
+    REQUIRE(nnue::xxh64::hash(spam.data(), spam.size()) == 0xFBCEA83C8A378BF1ULL);
+}
+
+TEST_CASE("nnue::weights -- Save and load with a header") {
+    const auto expected = random_weights();
+    const std::string path = "nnue-save-test.bin";
+    expected.save(path);
+
+    auto loaded = nnue::weights<float>{}.load(path);
+    REQUIRE(loaded.w.borrowed());
+    REQUIRE(nnue::file_element(path) == nnue::element_type::f32);
+    for (const auto &fen : {"startpos", "x5o/1xx4/2oxo2/2xox2/3o3/7/o5x x 0 1"}) {
+        const libataxx::Position pos{fen};
+        REQUIRE(FloatTryhard::eval(pos, loaded) == FloatTryhard::eval(pos, expected));
+    }
+
+    // A float network isn't a quantized one
+    REQUIRE_THROWS_AS(nnue::quantized_weights{}.load(path), nnue::load_error);
+
+    // Truncated
+    std::string bytes;
+    {
+        std::ifstream file(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    const auto write = [&path](const std::string &data) {
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(data.data(), data.size());
+    };
+    write(bytes.substr(0, bytes.size() - 4));
+    REQUIRE_THROWS_AS(nnue::weights<float>{}.load(path), nnue::load_error);
+
+    // Corrupted parameter
+    auto corrupted = bytes;
+    corrupted[sizeof(nnue::file_header) + 100] ^= 1;
+    write(corrupted);
+    REQUIRE_THROWS_AS(nnue::weights<float>{}.load(path), nnue::load_error);
+
+    // Different architecture
+    auto resized = bytes;
+    nnue::file_header header;
+    std::memcpy(&header, resized.data(), sizeof(header));
+    header.dims.base_dim = 64;
+    std::memcpy(resized.data(), &header, sizeof(header));
+    write(resized);
+    REQUIRE_THROWS_AS(nnue::weights<float>{}.load(path), nnue::load_error);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("nnue::weights -- Half precision rows load from a float file") {
+    const auto expected = random_weights();
+    const std::string path = "nnue-half-test.bin";
+    expected.save(path);
+
+    const auto narrowed_bf16 = nnue::weights<float, nnue::architecture<32>, nnue::bf16>{}.narrow(expected);
+    const auto narrowed_fp16 = nnue::weights<float, nnue::architecture<32>, nnue::fp16>{}.narrow(expected);
+    const auto loaded_bf16 = nnue::weights<float, nnue::architecture<32>, nnue::bf16>{}.load(path);
+    const auto loaded_fp16 = nnue::weights<float, nnue::architecture<32>, nnue::fp16>{}.load(path);
+
+    for (const auto &fen :
+         {"startpos", "x5o/1xx4/2oxo2/2xox2/3o3/7/o5x x 0 1", "7/7/7/7/ooooooo/ooooooo/xxxxxxx o 0 1"}) {
+        const libataxx::Position pos{fen};
+        const int score = FloatTryhard::eval(pos, expected);
+        REQUIRE(Bf16Tryhard::eval(pos, loaded_bf16) == Bf16Tryhard::eval(pos, narrowed_bf16));
+        REQUIRE(Fp16Tryhard::eval(pos, loaded_fp16) == Fp16Tryhard::eval(pos, narrowed_fp16));
+        // Only the rows lose precision, and the sums over them stay float
+        REQUIRE(std::abs(Bf16Tryhard::eval(pos, loaded_bf16) - score) <= 8);
+        REQUIRE(std::abs(Fp16Tryhard::eval(pos, loaded_fp16) - score) <= 2);
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("nnue::weights -- Load from a pipe") {
+    const auto expected = random_weights();
+    const std::string path = "nnue-pipe-test.bin";
+    expected.save(path);
+    std::string bytes;
+    {
+        std::ifstream file(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    std::remove(path.c_str());
+
+    // A pipe has no size and can't be mapped, so it is read up to its end
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    std::thread writer([&] {
+        std::size_t done = 0;
+        while (done < bytes.size()) {
+            const auto n = ::write(fds[1], bytes.data() + done, bytes.size() - done);
+            if (n <= 0) {
+                break;
+            }
+            done += static_cast<std::size_t>(n);
+        }
+        ::close(fds[1]);
+    });
+    const nnue::weights_mapping mapping("/dev/fd/" + std::to_string(fds[0]));
+    // A mapping that stopped short fails the writer instead of leaving it blocked
+    ::signal(SIGPIPE, SIG_IGN);
+    ::close(fds[0]);
+    writer.join();
+
+    REQUIRE(!mapping.mapped());
+    REQUIRE(mapping.size() == bytes.size());
+    const auto loaded = nnue::weights<float>{}.load(nnue::weights_streamer("pipe", mapping));
+    for (const auto &fen : {"startpos", "x5o/1xx4/2oxo2/2xox2/3o3/7/o5x x 0 1"}) {
+        const libataxx::Position pos{fen};
+        REQUIRE(FloatTryhard::eval(pos, loaded) == FloatTryhard::eval(pos, expected));
+    }
+}
+
+TEST_CASE("nnue::quantized_weights -- Save and load with a header") {
+    const auto expected = nnue::quantized_weights{}.quantize(random_weights());
+    const std::string path = "nnue-save-quantized-test.bin";
+    expected.save(path);
+
+    REQUIRE(nnue::file_element(path) == nnue::element_type::quantized);
+    REQUIRE_THROWS_AS(nnue::weights<float>{}.load(path), nnue::load_error);
+    const auto loaded = nnue::quantized_weights{}.load(path);
+    std::remove(path.c_str());
+
+    REQUIRE(loaded.w.borrowed());
+    REQUIRE(loaded.fc0_shift == expected.fc0_shift);
+    REQUIRE(loaded.fc1_shift == expected.fc1_shift);
+    REQUIRE(loaded.output_scale == expected.output_scale);
+    for (const auto &fen : {"startpos", "x5o/1xx4/2oxo2/2xox2/3o3/7/o5x x 0 1"}) {
+        const libataxx::Position pos{fen};
+        REQUIRE(QuantizedTryhard::eval(pos, loaded) == QuantizedTryhard::eval(pos, expected));
+    }
+}
+
+TEST_CASE("nnue::architecture -- Networks pick their architecture from the header") {
+    using Wide = nnue::architecture<128>;
+    const auto expected = random_weights<Wide>();
+    const std::string path = "nnue-save-wide-test.bin";
+    expected.save(path);
+
+    // Loaded only as the architecture the file was saved with
+    REQUIRE_THROWS_AS(nnue::weights<float>{}.load(path), nnue::load_error);
+    const nnue::weights_mapping mapping(path);
+    const auto dims = nnue::file_dimensions(path, mapping, nnue::weights<float>::dims);
+    REQUIRE(dims == Wide::dims);
+    std::size_t width = 0;
+    REQUIRE(nnue::with_architecture(dims, [&](const auto arch) { width = arch.base_dim; }));
+    REQUIRE(width == Wide::base_dim);
+
+    auto unknown = dims;
+    unknown.base_dim = 48;
+    REQUIRE_FALSE(nnue::with_architecture(unknown, [](const auto) {}));
+
+    const auto loaded = nnue::weights<float, Wide>{}.load(path);
+    const auto quantized = nnue::basic_quantized_weights<Wide>{}.quantize(loaded);
+    std::remove(path.c_str());
+
+    using WideTryhard = search::tryhard::Tryhard<nnue::eval<float, Wide>>;
+    using WideQuantizedTryhard = search::tryhard::Tryhard<nnue::basic_quantized_eval<Wide>>;
+    for (const auto &fen : {"startpos", "x5o/1xx4/2oxo2/2xox2/3o3/7/o5x x 0 1"}) {
+        const libataxx::Position pos{fen};
+        const int score = WideTryhard::eval(pos, expected);
+        REQUIRE(WideTryhard::eval(pos, loaded) == score);
+        REQUIRE(std::abs(WideQuantizedTryhard::eval(pos, quantized) - score) <= 16);
+    }
+}
+
+TEST_CASE("nnue::shared -- Processes attach to a network in shared memory") {
+    const auto expected = random_weights();
+    const auto quantized = nnue::quantized_weights{}.quantize(expected);
+    const auto float_name = nnue::shared_name("float-test" + std::to_string(::getpid()), 32, expected.signature());
+    const auto quantized_name = nnue::shared_name("quantized-test" + std::to_string(::getpid()), 32, 0);
+
+    REQUIRE(nnue::attach_shared(float_name).data() == nullptr);
+    const auto created = nnue::create_shared(float_name, [&](nnue::weights_writer &ww) { expected.share_(ww); });
+    REQUIRE(created.data() != nullptr);
+    // Only one process gets to write a network
+    REQUIRE(nnue::create_shared(float_name, [&](nnue::weights_writer &ww) { expected.share_(ww); }).data() ==
+            nullptr);
+    const auto created_quantized =
+        nnue::create_shared(quantized_name, [&](nnue::weights_writer &ww) { quantized.share_(ww); });
+
+    const auto float_payload = nnue::attach_shared(float_name);
+    const auto quantized_payload = nnue::attach_shared(quantized_name);
+    nnue::remove_shared(float_name);
+    nnue::remove_shared(quantized_name);
+    REQUIRE(float_payload.size() == created.size());
+    REQUIRE(quantized_payload.data() != nullptr);
+
+    const auto attached = nnue::weights<float>{}.attach(nnue::weights_streamer(float_name, float_payload));
+    const auto attached_quantized =
+        nnue::quantized_weights{}.attach(nnue::weights_streamer(quantized_name, quantized_payload));
+
+    // The flip rows are read in place along with the feature rows
+    REQUIRE(attached.w.borrowed());
+    REQUIRE(attached.w.F == reinterpret_cast<const float *>(float_payload.data()) + attached.w.W_numel);
+    REQUIRE(attached.signature() == expected.signature());
+    REQUIRE(attached_quantized.fc0_shift == quantized.fc0_shift);
+    REQUIRE(attached_quantized.output_scale == quantized.output_scale);
+    for (const auto &fen : {"startpos", "x5o/1xx4/2oxo2/2xox2/3o3/7/o5x x 0 1", "x5o/7/7/7/7/7/o5x o 0 1"}) {
+        const libataxx::Position pos{fen};
+        REQUIRE(FloatTryhard::eval(pos, attached) == FloatTryhard::eval(pos, expected));
+        REQUIRE(QuantizedTryhard::eval(pos, attached_quantized) == QuantizedTryhard::eval(pos, quantized));
+    }
+
+    // A copy keeps reading the shared rows
+    const auto copy = attached;
+    REQUIRE(copy.w.F == attached.w.F);
+
+    // A truncated object is refused
+    const std::string truncated(created.data(), created.size() / 2);
+    const nnue::weights_mapping short_payload(std::shared_ptr<const char>(truncated.data(), [](const char *) {}),
+                                              truncated.size(),
+                                              false);
+    REQUIRE_THROWS_AS(nnue::weights<float>{}.attach(nnue::weights_streamer(float_name, short_payload)),
+                      nnue::load_error);
+}
+
+TEST_CASE("nnue::shared -- Objects whose payload doesn't match its hash are refused") {
+    const auto weights = random_weights();
+    const auto name = nnue::shared_name("corrupt-test" + std::to_string(::getpid()), 32, weights.signature());
+    const auto created = nnue::create_shared(name, [&](nnue::weights_writer &ww) { weights.share_(ww); });
+    REQUIRE(created.data() != nullptr);
+    REQUIRE(nnue::attach_shared(name).data() != nullptr);
+
+    // Whoever else can write under the name changes a byte of the payload
+    const int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    REQUIRE(fd >= 0);
+    const size_t size = sizeof(nnue::shared_header) + created.size();
+    void *addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    REQUIRE(addr != MAP_FAILED);
+    static_cast<char *>(addr)[sizeof(nnue::shared_header) + created.size() / 2] ^= 1;
+    ::munmap(addr, size);
+
+    REQUIRE(nnue::attach_shared(name).data() == nullptr);
+    nnue::remove_shared(name);
+}
+
+TEST_CASE("nnue::shared -- Objects others can write to are refused") {
+    const auto weights = random_weights();
+    const auto name = nnue::shared_name("mode-test" + std::to_string(::getpid()), 32, weights.signature());
+    REQUIRE(name.find("-u" + std::to_string(::geteuid()) + "-") != std::string::npos);
+    const auto created = nnue::create_shared(name, [&](nnue::weights_writer &ww) { weights.share_(ww); });
+    REQUIRE(created.data() != nullptr);
+
+    const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    REQUIRE(fd >= 0);
+    struct stat st {};
+    REQUIRE(::fstat(fd, &st) == 0);
+    REQUIRE((st.st_mode & 0777) == 0600);
+    REQUIRE(nnue::attach_shared(name).data() != nullptr);
+
+    REQUIRE(::fchmod(fd, 0666) == 0);
+    ::close(fd);
+    REQUIRE(nnue::attach_shared(name).data() == nullptr);
+    nnue::remove_shared(name);
+}
+
+TEST_CASE("nnue::shared -- Objects left unfinished by a dead writer are replaced") {
+    const auto weights = random_weights();
+    const auto name = nnue::shared_name("abandoned-test" + std::to_string(::getpid()), 32, weights.signature());
+    const auto write = [&](nnue::weights_writer &ww) { weights.share_(ww); };
+
+    // A header that never got marked ready, by a writer still holding its lock
+    const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    REQUIRE(fd >= 0);
+    REQUIRE(::flock(fd, LOCK_EX) == 0);
+    const nnue::shared_header header{};
+    REQUIRE(::pwrite(fd, &header, sizeof(header), 0) == sizeof(header));
+    REQUIRE(nnue::create_shared(name, write).data() == nullptr);
+
+    // Its writer is gone, and with it the lock
+    ::close(fd);
+    REQUIRE(nnue::attach_shared(name).data() == nullptr);
+    const auto created = nnue::create_shared(name, write);
+    REQUIRE(created.data() != nullptr);
+    REQUIRE(nnue::attach_shared(name).data() != nullptr);
+    nnue::remove_shared(name);
+}
+
+TEST_CASE("nnue::shared -- The last process to detach from an object removes it") {
+    const auto weights = random_weights();
+    const auto name = nnue::shared_name("detach-test" + std::to_string(::getpid()), 32, weights.signature());
+    const auto write = [&](nnue::weights_writer &ww) { weights.share_(ww); };
+
+    {
+        const auto created = nnue::create_shared(name, write);
+        auto attached = nnue::attach_shared(name);
+        REQUIRE(attached.data() != nullptr);
+        attached = {};
+        REQUIRE(nnue::attach_shared(name).data() != nullptr);
+    }
+    REQUIRE(nnue::attach_shared(name).data() == nullptr);
+
+    // A process that exits without detaching leaves its object to the next one attached to it
+    const pid_t child = ::fork();
+    if (child == 0) {
+        const auto created = nnue::create_shared(name, write);
+        ::_exit(created.data() != nullptr ? 0 : 1);
+    }
+    int status = 0;
+    REQUIRE(::waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+    REQUIRE(nnue::attach_shared(name).data() != nullptr);
+    REQUIRE(nnue::attach_shared(name).data() == nullptr);
+}
@@ -0,0 +1,103 @@
+#include <catch2/catch.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <libataxx/move.hpp>
+#include <libataxx/position.hpp>
+#include <random>
+#include <string>
+#include "../src/search/tryhard/nnue_model.hpp"
+#include "../src/search/tryhard/nnue_quantized.hpp"
+#include "../src/search/tryhard/tryhard.hpp"
+#include "nnue-random.hpp"
+
+using FloatTryhard = search::tryhard::Tryhard<nnue::eval<float>>;
+using QuantizedTryhard = search::tryhard::Tryhard<nnue::quantized_eval>;
+
+constexpr int tolerance = 16;
+constexpr float mean_tolerance = 5.0f;
+
+TEST_CASE("nnue::quantized_eval -- Agrees with nnue::eval<float>") {
+    const auto weights = random_weights();
+    const auto quantized_weights = nnue::quantized_weights{}.quantize(weights);
+    const std::string fens[] = {
+        "startpos",
+        "x5o/7/2-1-2/7/2-1-2/7/o5x x 0 1",
+        "x5o/1xx4/2oxo2/2xox2/3o3/7/o5x x 0 1",
+        "7/7/7/7/ooooooo/ooooooo/xxxxxxx x 0 1",
+    };
+
+    std::mt19937 gen{42};
+    int total_error = 0;
+    int num_evals = 0;
+    for (const auto &fen : fens) {
+        libataxx::Position pos{fen};
+
+        for (int ply = 0; ply < 40 && !pos.gameover(); ++ply) {
+            const int float_score = FloatTryhard::eval(pos, weights);
+            const int quantized_score = QuantizedTryhard::eval(pos, quantized_weights);
+            REQUIRE(std::abs(float_score - quantized_score) <= tolerance);
+            total_error += std::abs(float_score - quantized_score);
+            num_evals++;
+
+            libataxx::Move moves[libataxx::max_moves];
+            const int num_moves = pos.legal_moves(moves);
+
+            // Both paths pick the same move at one ply unless the float scores are within tolerance
+            int float_best = 0;
+            int quantized_best = 0;
+            int float_scores[libataxx::max_moves];
+            int quantized_scores[libataxx::max_moves];
+            for (int i = 0; i < num_moves; ++i) {
+                auto npos = pos;
+                npos.makemove(moves[i]);
+                float_scores[i] = -FloatTryhard::eval(npos, weights);
+                quantized_scores[i] = -QuantizedTryhard::eval(npos, quantized_weights);
+                float_best = float_scores[i] > float_scores[float_best] ? i : float_best;
+                quantized_best = quantized_scores[i] > quantized_scores[quantized_best] ? i : quantized_best;
+            }
+            REQUIRE(float_scores[float_best] - float_scores[quantized_best] <= 2 * tolerance);
+
+            pos.makemove(moves[std::uniform_int_distribution<int>{0, num_moves - 1}(gen)]);
+        }
+    }
+
+    REQUIRE(static_cast<float>(total_error) / num_evals <= mean_tolerance);
+}
+
+// Largest accumulator entry of any position, summed over the quantized rows as the accumulators are
+template <typename Affine>
+int max_accumulator(const Affine &affine) {
+    constexpr std::size_t squares = nnue::half_ka_numel / 2;
+    int result = 0;
+    for (std::size_t j = 0; j < nnue::default_architecture::base_dim; ++j) {
+        int bound = std::abs(affine.b[j]);
+        for (std::size_t sq = 0; sq < squares; ++sq) {
+            const int us = affine.W[sq * nnue::default_architecture::base_dim + j];
+            const int them = affine.W[(squares + sq) * nnue::default_architecture::base_dim + j];
+            bound += std::max(std::abs(us), std::abs(them));
+        }
+        result = std::max(result, bound);
+    }
+    return result;
+}
+
+TEST_CASE("nnue::quantized_weights -- Accumulators fit int16 despite rounding") {
+    auto weights = random_weights();
+    REQUIRE(max_accumulator(nnue::quantized_weights{}.quantize(weights).w) <= 32767);
+
+    // Every row of a full board rounds up, by as much as the scale lets them
+    constexpr std::size_t squares = nnue::half_ka_numel / 2;
+    for (std::size_t i = 0; i < weights.w.W_numel; ++i) {
+        weights.w.W[i] = i < squares * nnue::default_architecture::base_dim ? 0.01f : 0.0f;
+        weights.b.W[i] = weights.w.W[i];
+    }
+    for (std::size_t j = 0; j < weights.w.b_numel; ++j) {
+        weights.w.b[j] = 0.0f;
+        weights.b.b[j] = 0.0f;
+    }
+    weights.w.derive_flips_();
+    weights.b.derive_flips_();
+    const auto quantized = nnue::quantized_weights{}.quantize(weights);
+    REQUIRE(max_accumulator(quantized.w) <= 32767);
+    REQUIRE(max_accumulator(quantized.b) <= 32767);
+}
@@ -0,0 +1,37 @@
+#ifndef TESTS_NNUE_RANDOM_HPP
+#define TESTS_NNUE_RANDOM_HPP
+
+#include <random>
+#include "../src/search/tryhard/nnue_model.hpp"
+
+// Random networks, shared by the tests and bench_nnue
+
+template <typename T>
+void randomize(T *data, const std::size_t numel, std::mt19937 &gen) {
+    std::normal_distribution<float> dist{0.0f, 0.15f};
+    for (std::size_t i = 0; i < numel; ++i) {
+        data[i] = dist(gen);
+    }
+}
+
+// A fixed random network, scaled so activations stay in a realistic range
+template <typename Arch = nnue::default_architecture>
+nnue::weights<float, Arch> random_weights() {
+    std::mt19937 gen{1234};
+    nnue::weights<float, Arch> weights;
+    randomize(weights.w.W, weights.w.W_numel, gen);
+    randomize(weights.w.b, weights.w.b_numel, gen);
+    randomize(weights.b.W, weights.b.W_numel, gen);
+    randomize(weights.b.b, weights.b.b_numel, gen);
+    randomize(weights.fc0.W, weights.fc0.W_numel, gen);
+    randomize(weights.fc0.b, weights.fc0.b_numel, gen);
+    randomize(weights.fc1.W, weights.fc1.W_numel, gen);
+    randomize(weights.fc1.b, weights.fc1.b_numel, gen);
+    randomize(weights.fc2.W, weights.fc2.W_numel, gen);
+    randomize(weights.fc2.b, weights.fc2.b_numel, gen);
+    weights.w.derive_flips_();
+    weights.b.derive_flips_();
+    return weights;
+}
+
+#endif
@@ -0,0 +1,338 @@
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "../src/search/tryhard/nnue_simd.hpp"
+
+using nnue::simd::instruction_set;
+
+constexpr instruction_set instruction_sets[] = {
+    instruction_set::scalar,
+    instruction_set::sse41,
+    instruction_set::avx2,
+    instruction_set::avx512,
+};
+
+constexpr std::pair<std::size_t, std::size_t> shapes[] = {
+    {64, 32},
+    {32, 32},
+    {64, 1},
+    {7, 13},
+    {33, 40},
+};
+
+TEST_CASE("nnue::simd -- Kernels match the scalar reference") {
+    std::mt19937 gen{7};
+    std::uniform_real_distribution<float> real{-1.0f, 1.0f};
+    std::uniform_int_distribution<int> i16{-4000, 4000};
+    std::uniform_int_distribution<int> i8{-127, 127};
+
+    for (const auto isa : instruction_sets) {
+        if (isa > nnue::simd::detect()) {
+            continue;
+        }
+        const auto kernels = nnue::simd::make_kernels(isa);
+        const auto reference = nnue::simd::make_kernels(instruction_set::scalar);
+
+        for (const auto &[dim0, dim1] : shapes) {
+            std::vector<float> x(dim0), W(dim0 * dim1), b(dim1), out(dim1), expected(dim1);
+            std::vector<std::int16_t> qx(dim0);
+            std::vector<std::int8_t> qW(dim0 * dim1);
+            std::vector<std::int32_t> qb(dim1), qout(dim1), qexpected(dim1);
+
+            for (std::size_t i = 0; i < dim0; ++i) {
+                x[i] = real(gen);
+                qx[i] = i16(gen);
+            }
+            for (std::size_t i = 0; i < dim0 * dim1; ++i) {
+                W[i] = real(gen);
+                qW[i] = i8(gen);
+            }
+            for (std::size_t i = 0; i < dim1; ++i) {
+                b[i] = real(gen);
+                qb[i] = i16(gen);
+            }
+
+            kernels.affine_f32(x.data(), W.data(), b.data(), out.data(), dim0, dim1);
+            reference.affine_f32(x.data(), W.data(), b.data(), expected.data(), dim0, dim1);
+            for (std::size_t j = 0; j < dim1; ++j) {
+                REQUIRE(std::abs(out[j] - expected[j]) <= 1e-4f);
+            }
+
+            kernels.affine_i8(qx.data(), qW.data(), qb.data(), qout.data(), dim0, dim1);
+            reference.affine_i8(qx.data(), qW.data(), qb.data(), qexpected.data(), dim0, dim1);
+            REQUIRE(qout == qexpected);
+
+            // Accumulator updates over a vector of length dim0
+            auto acc = x;
+            auto acc_expected = x;
+            kernels.add_f32(acc.data(), W.data(), dim0);
+            kernels.sub_f32(acc.data(), x.data(), dim0);
+            reference.add_f32(acc_expected.data(), W.data(), dim0);
+            reference.sub_f32(acc_expected.data(), x.data(), dim0);
+            REQUIRE(acc == acc_expected);
+
+            auto qacc = qx;
+            auto qacc_expected = qx;
+            kernels.add_i16(qacc.data(), qx.data(), dim0);
+            kernels.sub_i16(qacc.data(), qx.data(), dim0);
+            kernels.add_i16(qacc.data(), qx.data(), dim0);
+            reference.add_i16(qacc_expected.data(), qx.data(), dim0);
+            REQUIRE(qacc == qacc_expected);
+
+            // Fused updates with several rows entering and leaving
+            std::vector<float> rows(4 * dim0);
+            std::vector<std::int16_t> qrows(4 * dim0);
+            for (std::size_t i = 0; i < 4 * dim0; ++i) {
+                rows[i] = real(gen);
+                qrows[i] = i16(gen);
+            }
+            for (std::size_t num_added = 0; num_added <= 4; ++num_added) {
+                const std::size_t num_removed = 4 - num_added;
+                const float* added[4];
+                const float* removed[4];
+                const std::int16_t* qadded[4];
+                const std::int16_t* qremoved[4];
+                for (std::size_t k = 0; k < 4; ++k) {
+                    (k < num_added ? added[k] : removed[k - num_added]) = rows.data() + k * dim0;
+                    (k < num_added ? qadded[k] : qremoved[k - num_added]) = qrows.data() + k * dim0;
+                }
+
+                kernels.update_f32(acc.data(), x.data(), added, num_added, removed, num_removed, dim0);
+                reference.update_f32(acc_expected.data(), x.data(), added, num_added, removed, num_removed, dim0);
+                REQUIRE(acc == acc_expected);
+
+                kernels.update_i16(qacc.data(), qx.data(), qadded, num_added, qremoved, num_removed, dim0);
+                reference.update_i16(qacc_expected.data(), qx.data(), qadded, num_added, qremoved, num_removed, dim0);
+                REQUIRE(qacc == qacc_expected);
+            }
+        }
+    }
+}
+
+TEST_CASE("nnue::simd -- Batched dense kernels match the single row kernels") {
+    std::mt19937 gen{11};
+    std::uniform_real_distribution<float> real{-1.0f, 1.0f};
+    std::uniform_int_distribution<int> i16{-4000, 4000};
+    std::uniform_int_distribution<int> i8{-127, 127};
+
+    for (const auto isa : instruction_sets) {
+        if (isa > nnue::simd::detect()) {
+            continue;
+        }
+        const auto kernels = nnue::simd::make_kernels(isa);
+
+        for (const auto &[dim0, dim1] : shapes) {
+            for (const std::size_t batch : {1, 3, 4, 9}) {
+                std::vector<float> x(batch * dim0), W(dim0 * dim1), b(dim1);
+                std::vector<float> out(batch * dim1), expected(batch * dim1);
+                std::vector<std::int16_t> qx(batch * dim0);
+                std::vector<std::int8_t> qW(dim0 * dim1);
+                std::vector<std::int32_t> qb(dim1), qout(batch * dim1), qexpected(batch * dim1);
+
+                for (std::size_t i = 0; i < batch * dim0; ++i) {
+                    x[i] = real(gen);
+                    qx[i] = i16(gen);
+                }
+                for (std::size_t i = 0; i < dim0 * dim1; ++i) {
+                    W[i] = real(gen);
+                    qW[i] = i8(gen);
+                }
+                for (std::size_t i = 0; i < dim1; ++i) {
+                    b[i] = real(gen);
+                    qb[i] = i16(gen);
+                }
+
+                kernels.affine_batch_f32(x.data(), W.data(), b.data(), out.data(), batch, dim0, dim1);
+                kernels.affine_batch_i8(qx.data(), qW.data(), qb.data(), qout.data(), batch, dim0, dim1);
+                for (std::size_t r = 0; r < batch; ++r) {
+                    kernels.affine_f32(
+                        x.data() + r * dim0, W.data(), b.data(), expected.data() + r * dim1, dim0, dim1);
+                    kernels.affine_i8(
+                        qx.data() + r * dim0, qW.data(), qb.data(), qexpected.data() + r * dim1, dim0, dim1);
+                }
+
+                // Same summation order per output, so even the float results are identical
+                REQUIRE(out == expected);
+                REQUIRE(qout == qexpected);
+            }
+        }
+    }
+}
+
+TEST_CASE("nnue::simd -- Sparse dense kernels match the dense kernels on relu'd inputs") {
+    std::mt19937 gen{13};
+    std::uniform_real_distribution<float> real{-1.0f, 1.0f};
+    std::uniform_int_distribution<int> i16{-4000, 4000};
+    std::uniform_int_distribution<int> i8{-127, 127};
+
+    for (const auto isa : instruction_sets) {
+        if (isa > nnue::simd::detect()) {
+            continue;
+        }
+        const auto kernels = nnue::simd::make_kernels(isa);
+        const auto reference = nnue::simd::make_kernels(instruction_set::scalar);
+
+        for (const auto &[dim0, dim1] : shapes) {
+            std::vector<float> x(dim0), relu_x(dim0), W(dim0 * dim1), b(dim1), out(dim1), expected(dim1);
+            std::vector<std::int16_t> qx(dim0), relu_qx(dim0);
+            std::vector<std::int8_t> qW(dim0 * dim1);
+            std::vector<std::int32_t> qb(dim1), qout(dim1), qexpected(dim1);
+
+            // Exact zeros as well as negative values have to be skipped
+            for (std::size_t i = 0; i < dim0; ++i) {
+                x[i] = i % 5 == 0 ? 0.0f : real(gen);
+                qx[i] = i % 5 == 0 ? 0 : i16(gen);
+                relu_x[i] = std::max(x[i], 0.0f);
+                relu_qx[i] = std::max<std::int16_t>(qx[i], 0);
+            }
+            for (std::size_t i = 0; i < dim0 * dim1; ++i) {
+                W[i] = real(gen);
+                qW[i] = i8(gen);
+            }
+            for (std::size_t i = 0; i < dim1; ++i) {
+                b[i] = real(gen);
+                qb[i] = i16(gen);
+            }
+
+            std::vector<std::uint32_t> indices(dim0 + nnue::simd::nonzero_slack);
+            std::vector<std::uint32_t> expected_indices(dim0 + nnue::simd::nonzero_slack);
+            const auto num = kernels.nonzero_f32(x.data(), dim0, indices.data());
+            const auto expected_num = reference.nonzero_f32(x.data(), dim0, expected_indices.data());
+            REQUIRE(num == expected_num);
+            for (std::size_t k = 0; k < num; ++k) {
+                REQUIRE(indices[k] == expected_indices[k]);
+            }
+
+            kernels.affine_sparse_f32(x.data(), indices.data(), num, W.data(), b.data(), out.data(), dim1);
+            kernels.affine_f32(relu_x.data(), W.data(), b.data(), expected.data(), dim0, dim1);
+            // A single output is a dot product, summed in another order by the dense kernels
+            for (std::size_t j = 0; j < dim1; ++j) {
+                REQUIRE((dim1 > 1 ? out[j] == expected[j] : std::abs(out[j] - expected[j]) <= 1e-4f));
+            }
+
+            const auto qnum = kernels.nonzero_i16(qx.data(), dim0, indices.data());
+            const auto qexpected_num = reference.nonzero_i16(qx.data(), dim0, expected_indices.data());
+            REQUIRE(qnum == qexpected_num);
+            for (std::size_t k = 0; k < qnum; ++k) {
+                REQUIRE(indices[k] == expected_indices[k]);
+            }
+
+            kernels.affine_sparse_i8(qx.data(), indices.data(), qnum, qW.data(), qb.data(), qout.data(), dim1);
+            kernels.affine_i8(relu_qx.data(), qW.data(), qb.data(), qexpected.data(), dim0, dim1);
+            REQUIRE(qout == qexpected);
+        }
+    }
+}
+
+TEST_CASE("nnue::simd -- Pair kernels match the dense int8 kernel") {
+    std::mt19937 gen{17};
+    std::uniform_int_distribution<int> i16{-4000, 4000};
+    std::uniform_int_distribution<int> i8{-127, 127};
+
+    for (const auto isa : instruction_sets) {
+        if (isa > nnue::simd::detect()) {
+            continue;
+        }
+        const auto kernels = nnue::simd::make_kernels(isa);
+
+        for (const auto &[dim0, dim1] : shapes) {
+            if (dim0 % 2 != 0) {
+                continue;
+            }
+            std::vector<std::int16_t> x(dim0), P(dim0 * dim1);
+            std::vector<std::int8_t> W(dim0 * dim1);
+            std::vector<std::int32_t> b(dim1), out(dim1), expected(dim1);
+
+            for (std::size_t i = 0; i < dim0; ++i) {
+                x[i] = i16(gen);
+            }
+            for (std::size_t i = 0; i < dim0 * dim1; ++i) {
+                W[i] = i8(gen);
+            }
+            for (std::size_t p = 0; p < dim0 / 2; ++p) {
+                for (std::size_t j = 0; j < dim1; ++j) {
+                    P[(p * dim1 + j) * 2] = W[2 * p * dim1 + j];
+                    P[(p * dim1 + j) * 2 + 1] = W[(2 * p + 1) * dim1 + j];
+                }
+            }
+            for (std::size_t i = 0; i < dim1; ++i) {
+                b[i] = i16(gen);
+            }
+
+            kernels.affine_pairs_i16(x.data(), P.data(), b.data(), out.data(), dim0, dim1);
+            kernels.affine_i8(x.data(), W.data(), b.data(), expected.data(), dim0, dim1);
+            REQUIRE(out == expected);
+        }
+    }
+}
+
+TEST_CASE("nnue::simd -- Half precision rows round to nearest even and widen exactly") {
+    // Exactly representable values survive the round trip
+    for (const float x : {0.0f, 1.0f, -2.5f, 0.15625f, 65504.0f, 0.00006103515625f}) {
+        REQUIRE(static_cast<float>(nnue::fp16::from(x)) == x);
+        if (x != 65504.0f && x != 0.00006103515625f) {
+            REQUIRE(static_cast<float>(nnue::bf16::from(x)) == x);
+        }
+    }
+
+    // Halfway cases go to the even neighbour
+    REQUIRE(static_cast<float>(nnue::bf16::from(1.0f + 1.0f / 256)) == 1.0f);
+    REQUIRE(static_cast<float>(nnue::bf16::from(1.0f + 3.0f / 256)) == 1.0f + 4.0f / 256);
+    REQUIRE(static_cast<float>(nnue::fp16::from(1.0f + 1.0f / 2048)) == 1.0f);
+    REQUIRE(static_cast<float>(nnue::fp16::from(1.0f + 3.0f / 2048)) == 1.0f + 4.0f / 2048);
+
+    // fp16 subnormals and overflow
+    REQUIRE(static_cast<float>(nnue::fp16::from(std::ldexp(3.0f, -24))) == std::ldexp(3.0f, -24));
+    REQUIRE(std::isinf(static_cast<float>(nnue::fp16::from(70000.0f))));
+
+    std::mt19937 gen{11};
+    std::normal_distribution<float> dist{0.0f, 0.15f};
+    for (int i = 0; i < 10000; ++i) {
+        const float x = dist(gen);
+        REQUIRE(std::abs(static_cast<float>(nnue::bf16::from(x)) - x) <= std::abs(x) / 256);
+        REQUIRE(std::abs(static_cast<float>(nnue::fp16::from(x)) - x) <= std::max(std::abs(x) / 2048, 3e-8f));
+    }
+}
+
+TEST_CASE("nnue::simd -- Half precision update kernels match the scalar reference") {
+    std::mt19937 gen{13};
+    std::normal_distribution<float> dist{0.0f, 0.15f};
+    constexpr std::size_t num_rows = 6;
+
+    for (const auto isa : instruction_sets) {
+        if (isa > nnue::simd::detect()) {
+            continue;
+        }
+        const auto kernels = nnue::simd::make_kernels(isa);
+        const auto reference = nnue::simd::make_kernels(instruction_set::scalar);
+
+        for (const std::size_t n : {32, 256, 37}) {
+            std::vector<float> src(n), out(n), expected(n);
+            std::vector<nnue::bf16> bf16_rows(num_rows * n);
+            std::vector<nnue::fp16> fp16_rows(num_rows * n);
+            for (std::size_t i = 0; i < n; ++i) {
+                src[i] = dist(gen);
+            }
+            for (std::size_t i = 0; i < num_rows * n; ++i) {
+                bf16_rows[i] = nnue::bf16::from(dist(gen));
+                fp16_rows[i] = nnue::fp16::from(dist(gen));
+            }
+            const nnue::bf16 *bf16_added[] = {&bf16_rows[0], &bf16_rows[n], &bf16_rows[2 * n], &bf16_rows[3 * n]};
+            const nnue::bf16 *bf16_removed[] = {&bf16_rows[4 * n], &bf16_rows[5 * n]};
+            const nnue::fp16 *fp16_added[] = {&fp16_rows[0], &fp16_rows[n], &fp16_rows[2 * n], &fp16_rows[3 * n]};
+            const nnue::fp16 *fp16_removed[] = {&fp16_rows[4 * n], &fp16_rows[5 * n]};
+
+            // Widening is exact and every lane sums in the same order, so results are bit for bit equal
+            kernels.update_bf16(out.data(), src.data(), bf16_added, 4, bf16_removed, 2, n);
+            reference.update_bf16(expected.data(), src.data(), bf16_added, 4, bf16_removed, 2, n);
+            REQUIRE(out == expected);
+
+            kernels.update_fp16(out.data(), src.data(), fp16_added, 4, fp16_removed, 2, n);
+            reference.update_fp16(expected.data(), src.data(), fp16_added, 4, fp16_removed, 2, n);
+            REQUIRE(out == expected);
+        }
+    }
+}
@@ -0,0 +1,164 @@
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <cmath>
+#include <libataxx/move.hpp>
+#include <libataxx/position.hpp>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/search/tryhard/nnue_model.hpp"
+#include "../src/search/tryhard/nnue_quantized.hpp"
+#include "../src/search/tryhard/refresh_cache.hpp"
+#include "../src/search/tryhard/tryhard.hpp"
+#include "nnue-random.hpp"
+
+using FloatTryhard = search::tryhard::Tryhard<nnue::eval<float>>;
+using QuantizedTryhard = search::tryhard::Tryhard<nnue::quantized_eval>;
+
+template <typename Eval>
+Eval refreshed(const libataxx::Position &pos, const typename Eval::weights_type &weights) {
+    auto evaluator = Eval{&weights};
+    nnue::feature_delta white;
+    nnue::feature_delta black;
+    search::tryhard::Tryhard<Eval>::position_delta(pos, white, black);
+    evaluator.white.refresh(white);
+    evaluator.black.refresh(black);
+    return evaluator;
+}
+
+// Play random games, updating the accumulators incrementally, and compare them with a refresh every ply
+template <typename Eval, typename F>
+void check_updates(const typename Eval::weights_type &weights, F &&same) {
+    const std::string fens[] = {
+        "startpos",
+        "x5o/7/2-1-2/7/2-1-2/7/o5x x 0 1",
+        "x5o/1xx4/2oxo2/2xox2/3o3/7/o5x x 0 1",
+    };
+
+    std::mt19937 gen{7};
+    for (const auto &fen : fens) {
+        libataxx::Position pos{fen};
+        auto evaluator = refreshed<Eval>(pos, weights);
+
+        for (int ply = 0; ply < 100 && !pos.gameover(); ++ply) {
+            libataxx::Move moves[libataxx::max_moves];
+            const int num_moves = pos.legal_moves(moves);
+            const auto move = moves[std::uniform_int_distribution<int>{0, num_moves - 1}(gen)];
+
+            nnue::feature_delta white;
+            nnue::feature_delta black;
+            search::tryhard::Tryhard<Eval>::move_delta(pos, move, white, black);
+            auto child = Eval{&weights};
+            child.white.update(evaluator.white, white);
+            child.black.update(evaluator.black, black);
+
+            pos.makemove(move);
+            evaluator = child;
+            const auto expected = refreshed<Eval>(pos, weights);
+            for (std::size_t i = 0; i < nnue::base_dim; ++i) {
+                REQUIRE(same(evaluator.white.active_.data[i], expected.white.active_.data[i]));
+                REQUIRE(same(evaluator.black.active_.data[i], expected.black.active_.data[i]));
+            }
+        }
+    }
+}
+
+TEST_CASE("nnue::feature_transformer -- Incremental updates match a refresh") {
+    const auto weights = random_weights();
+    const auto quantized_weights = nnue::quantized_weights{}.quantize(weights);
+
+    check_updates<nnue::eval<float>>(weights, [](const float a, const float b) { return std::abs(a - b) <= 1e-3f; });
+    check_updates<nnue::quantized_eval>(quantized_weights, [](const auto a, const auto b) { return a == b; });
+}
+
+// Refresh the positions of random games through a cache, in order and shuffled, and compare with plain refreshes
+template <typename Eval, typename F>
+void check_refresh_cache(const typename Eval::weights_type &weights, F &&same) {
+    std::mt19937 gen{11};
+    std::vector<libataxx::Position> positions;
+    for (const auto &fen : {"startpos", "x5o/1xx4/2oxo2/2xox2/3o3/7/o5x x 0 1"}) {
+        libataxx::Position pos{fen};
+        for (int ply = 0; ply < 60 && !pos.gameover(); ++ply) {
+            positions.push_back(pos);
+            libataxx::Move moves[libataxx::max_moves];
+            const int num_moves = pos.legal_moves(moves);
+            pos.makemove(moves[std::uniform_int_distribution<int>{0, num_moves - 1}(gen)]);
+        }
+    }
+    auto shuffled = positions;
+    std::shuffle(shuffled.begin(), shuffled.end(), gen);
+    positions.insert(positions.end(), shuffled.begin(), shuffled.end());
+
+    search::tryhard::RefreshCache<Eval> cache;
+    for (const auto &pos : positions) {
+        auto evaluator = Eval{&weights};
+        cache.refresh(evaluator, pos);
+        const auto expected = refreshed<Eval>(pos, weights);
+        for (std::size_t i = 0; i < nnue::base_dim; ++i) {
+            REQUIRE(same(evaluator.white.active_.data[i], expected.white.active_.data[i]));
+            REQUIRE(same(evaluator.black.active_.data[i], expected.black.active_.data[i]));
+        }
+    }
+    REQUIRE(cache.hits() > 0);
+    REQUIRE(cache.hits() + cache.misses() == positions.size());
+}
+
+TEST_CASE("search::tryhard::RefreshCache -- Cached refreshes match a refresh") {
+    const auto weights = random_weights();
+    const auto quantized_weights = nnue::quantized_weights{}.quantize(weights);
+
+    check_refresh_cache<nnue::eval<float>>(weights,
+                                           [](const float a, const float b) { return std::abs(a - b) <= 1e-3f; });
+    check_refresh_cache<nnue::quantized_eval>(quantized_weights, [](const auto a, const auto b) { return a == b; });
+}
+
+TEST_CASE("search::tryhard::Tryhard -- Batched evaluation matches single evaluations") {
+    const auto weights = random_weights();
+    const auto quantized_weights = nnue::quantized_weights{}.quantize(weights);
+
+    std::mt19937 gen{13};
+    std::vector<libataxx::Position> positions;
+    while (positions.size() < 2 * nnue::eval_batch_size + 5) {
+        libataxx::Position pos{"startpos"};
+        for (int ply = 0; ply < 80 && !pos.gameover(); ++ply) {
+            positions.push_back(pos);
+            libataxx::Move moves[libataxx::max_moves];
+            const int num_moves = pos.legal_moves(moves);
+            pos.makemove(moves[std::uniform_int_distribution<int>{0, num_moves - 1}(gen)]);
+        }
+    }
+
+    std::vector<int> scores(positions.size());
+    std::vector<int> quantized_scores(positions.size());
+    search::tryhard::RefreshCache<nnue::eval<float>> cache;
+    search::tryhard::RefreshCache<nnue::quantized_eval> quantized_cache;
+    FloatTryhard::eval(positions.data(), positions.size(), weights, cache, scores.data());
+    QuantizedTryhard::eval(
+        positions.data(), positions.size(), quantized_weights, quantized_cache, quantized_scores.data());
+
+    // On the same accumulators the batch gives exactly the scores of evaluate()
+    std::vector<nnue::eval<float>> evaluators;
+    std::vector<nnue::quantized_eval> quantized_evaluators;
+    std::unique_ptr<bool[]> povs(new bool[positions.size()]);
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        evaluators.push_back(refreshed<nnue::eval<float>>(positions[i], weights));
+        quantized_evaluators.push_back(refreshed<nnue::quantized_eval>(positions[i], quantized_weights));
+        povs[i] = static_cast<bool>(positions[i].turn());
+    }
+    std::vector<int> batch(positions.size());
+    std::vector<int> quantized_batch(positions.size());
+    nnue::eval<float>::evaluate_batch(evaluators.data(), povs.get(), batch.data(), positions.size());
+    nnue::quantized_eval::evaluate_batch(
+        quantized_evaluators.data(), povs.get(), quantized_batch.data(), positions.size());
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        REQUIRE(batch[i] == evaluators[i].evaluate(povs[i]));
+        REQUIRE(quantized_batch[i] == quantized_evaluators[i].evaluate(povs[i]));
+    }
+
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        // Float accumulators from the cache may differ from a refresh in the last bits
+        REQUIRE(std::abs(scores[i] - FloatTryhard::eval(positions[i], weights)) <= 1);
+        REQUIRE(quantized_scores[i] == QuantizedTryhard::eval(positions[i], quantized_weights));
+    }
+}
@@ -0,0 +1,72 @@
+#include <catch2/catch.hpp>
+#include <libataxx/position.hpp>
+#include "../src/search/tryhard/nnue_model.hpp"
+#include "../src/search/tryhard/tryhard.hpp"
+#include "nnue-random.hpp"
+
+using search::tryhard::lazy_cutoff;
+
+TEST_CASE("tryhard::lazy_cutoff -- Only positions the margin outside of the window are cut") {
+    // Off
+    REQUIRE(!lazy_cutoff(5000, -50, 50, 0));
+    REQUIRE(!lazy_cutoff(-5000, -50, 50, 0));
+
+    // Above beta
+    REQUIRE(lazy_cutoff(350, -50, 50, 300));
+    REQUIRE(lazy_cutoff(1000, -50, 50, 300));
+    REQUIRE(!lazy_cutoff(349, -50, 50, 300));
+
+    // Below alpha
+    REQUIRE(lazy_cutoff(-350, -50, 50, 300));
+    REQUIRE(lazy_cutoff(-1000, -50, 50, 300));
+    REQUIRE(!lazy_cutoff(-349, -50, 50, 300));
+
+    // Inside of the window
+    REQUIRE(!lazy_cutoff(0, -50, 50, 300));
+    REQUIRE(!lazy_cutoff(0, -50, 50, 1));
+
+    // Null windows
+    REQUIRE(lazy_cutoff(400, 99, 100, 300));
+    REQUIRE(!lazy_cutoff(399, 99, 100, 300));
+    REQUIRE(lazy_cutoff(-201, 99, 100, 300));
+    REQUIRE(!lazy_cutoff(-200, 99, 100, 300));
+}
+
+TEST_CASE("tryhard::lazy_cutoff -- Blowouts are cut, balanced positions aren't") {
+    const libataxx::Position balanced{"x5o/7/7/7/7/7/o5x x 0 1"};
+    const libataxx::Position winning{"xxxxxxx/xxxxxxx/xxxxxxx/xxxx3/7/7/o6 x 0 1"};
+    const libataxx::Position losing{"xxxxxxx/xxxxxxx/xxxxxxx/xxxx3/7/7/o6 o 0 1"};
+
+    const int balanced_score = search::tryhard::classical(balanced);
+    const int winning_score = search::tryhard::classical(winning);
+    const int losing_score = search::tryhard::classical(losing);
+    REQUIRE(winning_score > 0);
+    REQUIRE(losing_score < 0);
+
+    for (const int margin : {200, 500, 1000}) {
+        REQUIRE(!lazy_cutoff(balanced_score, balanced_score - 1, balanced_score + 1, margin));
+        REQUIRE(lazy_cutoff(winning_score, -100, 100, margin));
+        REQUIRE(lazy_cutoff(losing_score, -100, 100, margin));
+    }
+}
+
+TEST_CASE("tryhard::Tryhard -- Lazy scores are returned outside of the window and never cached") {
+    using Tryhard = search::tryhard::Tryhard<nnue::eval<float>>;
+    const auto weights = random_weights();
+    const libataxx::Position winning{"xxxxxxx/xxxxxxx/xxxxxxx/xxxx3/7/7/o6 x 0 1"};
+    const int classical_score = search::tryhard::classical(winning);
+    const int network_score = Tryhard::eval(winning, weights);
+    REQUIRE(classical_score != network_score);
+
+    Tryhard tryhard{1, 1, 300, weights};
+    Tryhard::Stack stack{};
+    stack.hash = winning.hash();
+    tryhard.init_pos(winning);
+
+    // Far above beta: the classical score stands in
+    REQUIRE(tryhard.eval(&stack, winning, -50, 50) == classical_score);
+
+    // Any window: the network, which the lazy score didn't take the cache slot of, then the cached network score
+    REQUIRE(tryhard.eval(&stack, winning) == network_score);
+    REQUIRE(tryhard.eval(&stack, winning, -50, 50) == network_score);
+}